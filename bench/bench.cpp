@@ -0,0 +1,308 @@
+// Microbenchmarks for the binding layer. Every benchmark is run several
+// times after a warm up, and the median and fastest time per operation are
+// written as JSON, to stdout or to the file given as the first argument, so
+// runs can be compared.
+
+#include <mrb/mrb_tools.hpp>
+#include <mrb/serialize.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int runs = 7;
+
+struct Result
+{
+    std::string name;
+    double median_ns;
+    double min_ns;
+    size_t iterations;
+};
+
+std::vector<Result> results;
+
+// Time `iterations` calls of `fn`, `runs` times
+template <typename FN>
+void bench(std::string const& name, size_t iterations, FN&& fn)
+{
+    for (size_t i = 0; i < iterations / 10 + 1; i++) {
+        fn();
+    }
+    std::vector<double> times;
+    for (int r = 0; r < runs; r++) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            fn();
+        }
+        std::chrono::duration<double, std::nano> const t = Clock::now() - start;
+        times.push_back(t.count() / static_cast<double>(iterations));
+    }
+    std::sort(times.begin(), times.end());
+    results.push_back({name, times[times.size() / 2], times[0], iterations});
+}
+
+struct Counter
+{
+    mrb_int value = 0;
+    mrb_int add(mrb_int x) { return value += x; }
+};
+
+// Call a method, restoring the arena so garbage does not pile up
+void call(mrb_state* ruby, mrb_value self, mrb_sym sym,
+          std::vector<mrb_value> const& args)
+{
+    auto arena = mrb_gc_arena_save(ruby);
+    mrb_funcall_argv(ruby, self, sym, static_cast<mrb_int>(args.size()),
+                     args.data());
+    mrb_gc_arena_restore(ruby, arena);
+}
+
+void bench_get_args(mrb_state* ruby)
+{
+    mrb::add_kernel_function(ruby, "args0", [] { return 0; });
+    mrb::add_kernel_function(ruby, "args1", [](int a) { return a; });
+    mrb::add_kernel_function(ruby, "args3",
+                             [](int a, int b, int c) { return a + b + c; });
+    mrb::add_kernel_function(ruby, "args6",
+                             [](int a, int b, int c, int d, int e, int f) {
+                                 return a + b + c + d + e + f;
+                             });
+    mrb::add_kernel_function(ruby, "args_mixed",
+                             [](int a, std::string const& s, float f) {
+                                 return a + static_cast<int>(s.size() + f);
+                             });
+    auto self = mrb_obj_value(ruby->kernel_module);
+    auto one = mrb_fixnum_value(1);
+    for (int n : {0, 1, 3, 6}) {
+        auto name = "args" + std::to_string(n);
+        std::vector<mrb_value> args(static_cast<size_t>(n), one);
+        auto sym = mrb_intern_cstr(ruby, name.c_str());
+        bench("get_args/" + std::to_string(n), 200000,
+              [&] { call(ruby, self, sym, args); });
+    }
+    std::vector<mrb_value> args{one, mrb::to_value("text", ruby),
+                                mrb_float_value(ruby, 1.5)};
+    for (auto v : args) {
+        mrb_gc_register(ruby, v);
+    }
+    auto sym = mrb_intern_cstr(ruby, "args_mixed");
+    bench("get_args/int_string_float", 200000,
+          [&] { call(ruby, self, sym, args); });
+}
+
+void bench_dispatch(mrb_state* ruby)
+{
+    auto* cls = mrb::make_class<Counter>(ruby, "Counter");
+    mrb::add_method<&Counter::add>(ruby, "add");
+    // The same method written directly against the C API
+    mrb_define_method(
+        ruby, cls, "add_c",
+        [](mrb_state* mrb, mrb_value self) {
+            mrb_int x = 0;
+            mrb_get_args(mrb, "i", &x);
+            auto* c = static_cast<Counter*>(DATA_PTR(self));
+            return mrb_int_value(mrb, c->add(x));
+        },
+        MRB_ARGS_REQ(1));
+
+    auto obj = mrb_obj_new(ruby, cls, 0, nullptr);
+    mrb_gc_register(ruby, obj);
+    std::vector<mrb_value> args{mrb_fixnum_value(1)};
+    auto add = mrb_intern_cstr(ruby, "add");
+    auto add_c = mrb_intern_cstr(ruby, "add_c");
+    bench("dispatch/add_method", 200000, [&] { call(ruby, obj, add, args); });
+    bench("dispatch/c_api", 200000, [&] { call(ruby, obj, add_c, args); });
+}
+
+void bench_conversions(mrb_state* ruby)
+{
+    // Depend on the boxing mode; floats and large integers may be allocated
+    bench("to_value/double", 200000, [&] {
+        auto arena = mrb_gc_arena_save(ruby);
+        mrb::to_value(1.5, ruby);
+        mrb_gc_arena_restore(ruby, arena);
+    });
+    bench("to_value/int64", 200000, [&] {
+        auto arena = mrb_gc_arena_save(ruby);
+        mrb::to_value(int64_t{1} << 40, ruby);
+        mrb_gc_arena_restore(ruby, arena);
+    });
+    std::vector<double> floats(256, 0.25);
+    auto floats_v = mrb::to_value(floats, ruby);
+    mrb_gc_register(ruby, floats_v);
+    bench("value_to/vector_double/256", 4000,
+          [&] { mrb::value_to<std::vector<double>>(floats_v, ruby); });
+
+    for (size_t n : {8, 256, 4096}) {
+        std::string s(n, 'x');
+        auto v = mrb::to_value(s, ruby);
+        mrb_gc_register(ruby, v);
+        auto size = std::to_string(n);
+        bench("to_value/string/" + size, 100000, [&] {
+            auto arena = mrb_gc_arena_save(ruby);
+            mrb::to_value(s, ruby);
+            mrb_gc_arena_restore(ruby, arena);
+        });
+        bench("value_to/string/" + size, 100000,
+              [&] { mrb::value_to<std::string>(v, ruby); });
+    }
+
+    for (size_t n : {8, 256, 4096}) {
+        std::vector<int> vec(n, 7);
+        auto v = mrb::to_value(vec, ruby);
+        mrb_gc_register(ruby, v);
+        auto size = std::to_string(n);
+        auto iters = 1000000 / n;
+        bench("to_value/vector/" + size, iters, [&] {
+            auto arena = mrb_gc_arena_save(ruby);
+            mrb::to_value(vec, ruby);
+            mrb_gc_arena_restore(ruby, arena);
+        });
+        bench("value_to/vector/" + size, iters,
+              [&] { mrb::value_to<std::vector<int>>(v, ruby); });
+    }
+
+    for (size_t n : {8, 256}) {
+        std::map<std::string, int> map;
+        for (size_t i = 0; i < n; i++) {
+            map["key" + std::to_string(i)] = static_cast<int>(i);
+        }
+        auto v = mrb::to_value(map, ruby);
+        mrb_gc_register(ruby, v);
+        auto size = std::to_string(n);
+        auto iters = 200000 / n;
+        bench("to_value/map/" + size, iters, [&] {
+            auto arena = mrb_gc_arena_save(ruby);
+            mrb::to_value(map, ruby);
+            mrb_gc_arena_restore(ruby, arena);
+        });
+        bench("value_to/map/" + size, iters, [&] {
+            auto arena = mrb_gc_arena_save(ruby);
+            mrb::value_to<std::map<std::string, int>>(v, ruby);
+            mrb_gc_arena_restore(ruby, arena);
+        });
+
+        // Straight to bytes, against value_to above
+        std::string buf;
+        for (auto const& [f, l] : {std::pair{mrb::Format::MessagePack, "msgpack"},
+                                   std::pair{mrb::Format::Json, "json"}}) {
+            auto format = f;
+            std::string const label = l;
+            bench("encode/" + label + "/map/" + size, iters, [&] {
+                buf.clear();
+                mrb::encode(ruby, v, format, buf);
+            });
+            bench("decode/" + label + "/map/" + size, iters, [&] {
+                auto arena = mrb_gc_arena_save(ruby);
+                mrb::decode(ruby, format, buf);
+                mrb_gc_arena_restore(ruby, arena);
+            });
+        }
+    }
+}
+
+void bench_values(mrb::mruby& ruby)
+{
+    auto* mrb = ruby.ptr();
+    auto str = mrb::to_value("pinned", mrb);
+    mrb_gc_register(mrb, str);
+    bench("value/pin_unpin", 200000, [&] { mrb::Value v(mrb, str); });
+
+    auto proc = ruby.try_exec("proc { |x| x }").value();
+    mrb_gc_register(mrb, proc);
+    bench("call_proc", 200000, [&] {
+        auto arena = mrb_gc_arena_save(mrb);
+        mrb::call_proc(mrb, proc, 1);
+        mrb_gc_arena_restore(mrb, arena);
+    });
+}
+
+void bench_exec()
+{
+    static const std::string script = R"(
+def fib(n)
+  n < 2 ? n : fib(n - 1) + fib(n - 2)
+end
+fib(10)
+)";
+    // Cold; the first exec in a fresh state
+    std::vector<double> times;
+    for (int r = 0; r < runs * 10; r++) {
+        mrb::mruby ruby;
+        auto start = Clock::now();
+        ruby.exec(script);
+        std::chrono::duration<double, std::nano> const t = Clock::now() - start;
+        times.push_back(t.count());
+    }
+    std::sort(times.begin(), times.end());
+    results.push_back(
+        {"exec/cold", times[times.size() / 2], times[0], times.size()});
+
+    mrb::mruby ruby;
+    bench("exec/warm", 1000, [&] { ruby.exec(script); });
+}
+
+void bench_states()
+{
+    bench("state/mrb_open_close", 200, [] { mrb_close(mrb_open()); });
+    bench("state/mruby", 200, [] { mrb::mruby ruby; });
+    bench("state/mruby_pool_allocator", 200, [] {
+        mrb::mruby ruby{std::make_shared<mrb::PoolAllocator>()};
+    });
+}
+
+#if defined(MRB_NAN_BOXING)
+constexpr const char* boxing = "nan";
+#elif defined(MRB_NO_BOXING)
+constexpr const char* boxing = "no";
+#else
+constexpr const char* boxing = "word";
+#endif
+
+void write_json(FILE* out)
+{
+    std::fprintf(out,
+                 "{\n  \"config\": {\"boxing\": \"%s\", "
+                 "\"mrb_int_bits\": %zu, \"value_bytes\": %zu},\n",
+                 boxing, sizeof(mrb_int) * 8, sizeof(mrb_value));
+    std::fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        auto const& r = results[i];
+        std::fprintf(out,
+                     "    {\"name\": \"%s\", \"median_ns\": %.1f, "
+                     "\"min_ns\": %.1f, \"iterations\": %zu}%s\n",
+                     r.name.c_str(), r.median_ns, r.min_ns, r.iterations,
+                     i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    mrb::mruby ruby;
+    bench_get_args(ruby.ptr());
+    bench_dispatch(ruby.ptr());
+    bench_conversions(ruby.ptr());
+    bench_values(ruby);
+    bench_exec();
+    bench_states();
+
+    auto* out = argc > 1 ? std::fopen(argv[1], "w") : stdout;
+    if (out == nullptr) {
+        std::fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+    write_json(out);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Binds a large synthetic set of classes and reports the size of the
+// binary, the time to register the bindings, and the time of the first
+// (cold) and following (warm) calls to every bound method.
+
+#include <mrb/mrb_tools.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef MRB_BLOAT_CLASSES
+#define MRB_BLOAT_CLASSES 200
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+template <int N>
+struct Widget
+{
+    int value = N;
+    float scale = 1.0F;
+    std::string label = "widget";
+
+    [[nodiscard]] int get() const { return value; }
+    void set(int v) { value = v; }
+    [[nodiscard]] int add(int a, int b) const { return value + a + b; }
+    [[nodiscard]] float scaled(float f) const { return f * scale; }
+    [[nodiscard]] std::string name() const { return label; }
+    void rename(std::string const& s) { label = s; }
+};
+
+// The methods called by the benchmark, and the arguments they take
+struct Call
+{
+    const char* name;
+    std::vector<mrb_value> args;
+};
+
+constexpr size_t bindings_per_class = 8;
+constexpr size_t class_count = MRB_BLOAT_CLASSES;
+
+std::array<std::string, class_count> class_names;
+
+template <int N>
+void bind(mrb_state* ruby)
+{
+    using W = Widget<N>;
+    class_names[N] = "Widget" + std::to_string(N);
+    mrb::make_class<W>(ruby, class_names[N].c_str());
+    mrb::add_method<&W::get>(ruby, "get");
+    mrb::add_method<&W::set>(ruby, "set");
+    mrb::add_method<&W::add>(ruby, "add");
+    mrb::add_method<&W::scaled>(ruby, "scaled");
+    mrb::add_method<&W::name>(ruby, "name");
+    mrb::add_method<&W::rename>(ruby, "rename");
+    mrb::attr_accessor<&W::scale>(ruby, "scale");
+}
+
+template <int... N>
+void bind_all(mrb_state* ruby, std::integer_sequence<int, N...>)
+{
+    (bind<N>(ruby), ...);
+}
+
+double elapsed_ns(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start)
+        .count();
+}
+
+int main(int argc, char** argv)
+{
+    auto* ruby = mrb_open();
+
+    auto start = Clock::now();
+    bind_all(ruby, std::make_integer_sequence<int, class_count>());
+    auto register_ns = elapsed_ns(start);
+
+    std::vector<Call> calls{
+        {"get", {}},
+        {"set", {mrb_fixnum_value(3)}},
+        {"add", {mrb_fixnum_value(1), mrb_fixnum_value(2)}},
+        {"scaled", {mrb_float_value(ruby, 2.0)}},
+        {"name", {}},
+        {"rename", {mrb::to_value("other", ruby)}},
+        {"scale", {}},
+        {"scale=", {mrb_float_value(ruby, 0.5)}},
+    };
+    for (auto const& call : calls) {
+        for (auto const& v : call.args) {
+            mrb_gc_register(ruby, v);
+        }
+    }
+
+    std::vector<mrb_value> objects;
+    for (auto const& name : class_names) {
+        auto obj = mrb_obj_new(ruby, mrb_class_get(ruby, name.c_str()), 0,
+                               nullptr);
+        mrb_gc_register(ruby, obj);
+        objects.push_back(obj);
+    }
+
+    // The first pass calls every method once, the second calls them again
+    std::array<double, 2> call_ns{};
+    for (auto& total : call_ns) {
+        for (auto obj : objects) {
+            for (auto const& call : calls) {
+                auto arena = mrb_gc_arena_save(ruby);
+                auto sym = mrb_intern_cstr(ruby, call.name);
+                auto t = Clock::now();
+                mrb_funcall_argv(ruby, obj, sym,
+                                 static_cast<mrb_int>(call.args.size()),
+                                 call.args.data());
+                total += elapsed_ns(t);
+                mrb_gc_arena_restore(ruby, arena);
+            }
+        }
+    }
+    if (ruby->exc != nullptr) {
+        std::printf("Call failed\n");
+        return 1;
+    }
+
+    auto const bindings = class_count * bindings_per_class;
+    auto const n = static_cast<double>(bindings);
+    std::printf("bindings:    %zu\n", bindings);
+    if (argc > 0) {
+        std::printf("binary size: %ju bytes\n",
+                    static_cast<uintmax_t>(std::filesystem::file_size(argv[0])));
+    }
+    std::printf("register:    %.0f ns per binding\n", register_ns / n);
+    std::printf("cold call:   %.0f ns\n", call_ns[0] / n);
+    std::printf("warm call:   %.0f ns\n", call_ns[1] / n);
+
+    mrb_close(ruby);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Build and run mrbbench for every value boxing mode and integer size.
+# Writes one JSON file per variant to the given directory (default
+# builds/bench-results) and prints the median times side by side.
+set -e
+cd "$(dirname "$0")/.."
+out=${1:-builds/bench-results}
+mkdir -p "$out"
+
+for boxing in WORD NAN NO; do
+    for bits in 32 64; do
+        name=$(echo "$boxing" | tr 'A-Z' 'a-z')-int$bits
+        dir=builds/bench-$name
+        cmake -S . -B "$dir" -DCMAKE_BUILD_TYPE=Release \
+            -DMRB_BOXING=$boxing -DMRB_INT_SIZE=$bits
+        cmake --build "$dir" -j
+        "$dir/mrbbench" "$out/$name.json"
+    done
+done
+
+awk '
+FNR == 1 {
+    v = FILENAME; sub(/.*\//, "", v); sub(/\.json$/, "", v)
+    vars[++nv] = v
+}
+/"name":/ {
+    match($0, /"name": "[^"]*"/); n = substr($0, RSTART + 9, RLENGTH - 10)
+    match($0, /"median_ns": [0-9.]+/); t[n, v] = substr($0, RSTART + 13, RLENGTH - 13)
+    if (!(n in seen)) { seen[n] = 1; names[++nn] = n }
+}
+END {
+    printf "%-32s", "median ns"
+    for (i = 1; i <= nv; i++) printf " %11s", vars[i]
+    print ""
+    for (j = 1; j <= nn; j++) {
+        printf "%-32s", names[j]
+        for (i = 1; i <= nv; i++) printf " %11s", t[names[j], vars[i]]
+        print ""
+    }
+}' "$out"/*.json
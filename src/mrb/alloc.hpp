@@ -0,0 +1,215 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace mrb {
+
+//! Memory use of one state, in bytes requested by mruby
+struct MemoryStats
+{
+    size_t bytes = 0;             //!< Currently allocated
+    size_t peak_bytes = 0;        //!< Highest `bytes` seen
+    size_t allocations = 0;       //!< Currently live allocations
+    size_t total_allocations = 0; //!< Allocations made since the state opened
+    size_t failed = 0;            //!< Allocations refused by the limit
+};
+
+// An allocator policy for a ruby state, installed with mrb_open_allocf().
+// It keeps live counters and enforces an optional hard limit; an allocation
+// that would go over it fails, and mruby raises NoMemoryError (after running
+// a full GC and trying again). The memory itself comes from the virtual
+// allocate(), reallocate() and deallocate(), which by default use malloc.
+//
+// The counters are atomic, so they can be read from other threads while the
+// state runs, but the allocator itself belongs to one state.
+class Allocator
+{
+    // Every block starts with a header holding its size, as mruby does not
+    // pass the old size when it reallocates or frees
+    struct alignas(std::max_align_t) Header
+    {
+        size_t size;
+    };
+
+    std::atomic<size_t> cur_bytes{0};
+    std::atomic<size_t> peak{0};
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> total{0};
+    std::atomic<size_t> refused{0};
+    std::atomic<size_t> max_bytes;
+
+    static Header* header_of(void* p) { return static_cast<Header*>(p) - 1; }
+
+protected:
+    virtual void* allocate(size_t size) { return std::malloc(size); }
+    virtual void* reallocate(void* p, size_t /*old_size*/, size_t size)
+    {
+        return std::realloc(p, size);
+    }
+    virtual void deallocate(void* p, size_t /*size*/) { std::free(p); }
+
+public:
+    //! `limit` is the most memory the state may use, or 0 for no limit
+    explicit Allocator(size_t limit = 0) : max_bytes(limit) {}
+    virtual ~Allocator() = default;
+
+    Allocator(Allocator const&) = delete;
+    Allocator& operator=(Allocator const&) = delete;
+
+    [[nodiscard]] size_t limit() const { return max_bytes; }
+    void set_limit(size_t limit) { max_bytes = limit; }
+
+    [[nodiscard]] MemoryStats stats() const
+    {
+        return {cur_bytes, peak, live, total, refused};
+    }
+
+    //! Allocate, resize or (if `size` is 0) free a block, like realloc()
+    void* realloc(void* p, size_t size)
+    {
+        constexpr size_t h = sizeof(Header);
+        if (size == 0) {
+            if (p != nullptr) {
+                auto* hdr = header_of(p);
+                cur_bytes -= hdr->size;
+                live--;
+                deallocate(hdr, hdr->size + h);
+            }
+            return nullptr;
+        }
+
+        size_t const old = p == nullptr ? 0 : header_of(p)->size;
+        size_t const lim = max_bytes;
+        if (lim != 0 && size > old && cur_bytes + (size - old) > lim) {
+            refused++;
+            return nullptr;
+        }
+
+        auto* hdr = static_cast<Header*>(
+            p == nullptr ? allocate(size + h)
+                         : reallocate(header_of(p), old + h, size + h));
+        if (hdr == nullptr) { return nullptr; }
+        hdr->size = size;
+
+        if (p == nullptr) {
+            live++;
+            total++;
+        }
+        // Wraps around when shrinking, which is what we want
+        size_t const now = cur_bytes += size - old;
+        auto high = peak.load();
+        while (now > high && !peak.compare_exchange_weak(high, now)) {}
+        return hdr + 1;
+    }
+
+    //! The function passed to mrb_open_allocf(), with the allocator as `ud`
+    static void* allocf(mrb_state* /*mrb*/, void* p, size_t size, void* ud)
+    {
+        return static_cast<Allocator*>(ud)->realloc(p, size);
+    }
+};
+
+// An allocator that serves small blocks from size class free lists carved
+// out of large chunks, which is much faster than malloc for the many small
+// objects mruby allocates, and keeps the memory of a state together. Larger
+// blocks go to malloc. Memory in the pool is only returned to the system
+// when the allocator is destroyed.
+class PoolAllocator : public Allocator
+{
+    static constexpr std::array<size_t, 6> class_sizes{32,  64,  128,
+                                                       256, 512, 1024};
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    struct Block
+    {
+        Block* next;
+    };
+
+    std::array<Block*, class_sizes.size()> free_lists{};
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    std::byte* chunk_pos = nullptr;
+    std::byte* chunk_end = nullptr;
+
+    //! The size class for `size`, or class_sizes.size() if it is too large
+    static size_t class_of(size_t size)
+    {
+        return static_cast<size_t>(
+            std::lower_bound(class_sizes.begin(), class_sizes.end(), size) -
+            class_sizes.begin());
+    }
+
+    void* take(size_t cls)
+    {
+        if (auto* b = free_lists[cls]) {
+            free_lists[cls] = b->next;
+            return b;
+        }
+        auto const size = class_sizes[cls];
+        if (chunk_pos == nullptr ||
+            static_cast<size_t>(chunk_end - chunk_pos) < size) {
+            chunks.emplace_back(new (std::nothrow) std::byte[chunk_size]);
+            chunk_pos = chunks.back().get();
+            if (chunk_pos == nullptr) {
+                chunks.pop_back();
+                return nullptr;
+            }
+            chunk_end = chunk_pos + chunk_size;
+        }
+        auto* p = chunk_pos;
+        chunk_pos += size;
+        return p;
+    }
+
+    void give(void* p, size_t cls)
+    {
+        auto* b = static_cast<Block*>(p);
+        b->next = free_lists[cls];
+        free_lists[cls] = b;
+    }
+
+protected:
+    void* allocate(size_t size) override
+    {
+        auto cls = class_of(size);
+        return cls < class_sizes.size() ? take(cls) : std::malloc(size);
+    }
+
+    void* reallocate(void* p, size_t old_size, size_t size) override
+    {
+        auto from = class_of(old_size);
+        auto to = class_of(size);
+        if (from == to) {
+            return from < class_sizes.size() ? p : std::realloc(p, size);
+        }
+        auto* np = allocate(size);
+        if (np != nullptr) {
+            std::memcpy(np, p, std::min(old_size, size));
+            deallocate(p, old_size);
+        }
+        return np;
+    }
+
+    void deallocate(void* p, size_t size) override
+    {
+        auto cls = class_of(size);
+        if (cls < class_sizes.size()) {
+            give(p, cls);
+        } else {
+            std::free(p);
+        }
+    }
+
+public:
+    using Allocator::Allocator;
+};
+
+} // namespace mrb
@@ -4,7 +4,6 @@ extern "C"
 {
 #include <mruby.h>
 #include <mruby/array.h>
-#include <mruby/boxing_word.h>
 #include <mruby/class.h>
 #include <mruby/compile.h>
 #include <mruby/data.h>
@@ -14,9 +13,14 @@ extern "C"
 #include <mruby/variable.h>
 }
 
+#include "symbols.hpp"
+
+#include <cmath>
+#include <limits>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -24,12 +28,13 @@ namespace mrb {
 
 inline std::vector<std::string> get_backtrace(mrb_state* ruby)
 {
-    auto bt = mrb_funcall(ruby, mrb_obj_value(ruby->exc), "backtrace", 0);
+    auto bt = mrb_funcall_argv(ruby, mrb_obj_value(ruby->exc),
+                               sym<names::backtrace>(ruby), 0, nullptr);
 
     std::vector<std::string> backtrace;
     for (int i = 0; i < ARY_LEN(mrb_ary_ptr(bt)); i++) {
         auto v = mrb_ary_entry(bt, i);
-        auto s = mrb_funcall(ruby, v, "to_s", 0);
+        auto s = mrb_funcall_argv(ruby, v, sym<names::to_s>(ruby), 0, nullptr);
         std::string const line(RSTRING_PTR(s), RSTRING_LEN(s));
         backtrace.emplace_back(line);
     }
@@ -42,5 +47,67 @@ struct mrb_exception : public std::exception
     std::string msg;
     [[nodiscard]] char const* what() const noexcept override { return msg.c_str(); }
 };
+
+//! True if mrb_int holds every value of the integer type INT. Depends on
+//! how mruby is built; see MRB_INT_SIZE in CMakeLists.txt.
+template <typename INT>
+constexpr bool fits_mrb_int()
+{
+    return std::numeric_limits<INT>::digits <=
+           std::numeric_limits<mrb_int>::digits;
+}
+
+//! True if `f` is within the range of the integer type INT
+template <typename INT>
+bool float_fits(mrb_float f)
+{
+    auto const limit =
+        std::ldexp(mrb_float{1}, std::numeric_limits<INT>::digits);
+    return f < limit && (std::is_signed_v<INT> ? f >= -limit : f >= 0);
+}
+
+//! True if `i` is within the range of mrb_int
+template <typename INT>
+bool int_fits(INT i)
+{
+    using Limits = std::numeric_limits<mrb_int>;
+    if constexpr (fits_mrb_int<INT>()) {
+        return true;
+    } else if constexpr (std::is_signed_v<INT>) {
+        return i >= Limits::min() && i <= Limits::max();
+    } else {
+        return i <= static_cast<std::make_unsigned_t<mrb_int>>(Limits::max());
+    }
+}
+
+//! True if integer_value() converts `i` without losing precision: it fits
+//! in mrb_int, or else in mrb_float exactly
+template <typename INT>
+bool integer_fits(INT i)
+{
+    if (int_fits(i)) { return true; }
+    auto f = static_cast<mrb_float>(i);
+    return float_fits<INT>(f) && static_cast<INT>(f) == i;
+}
+
+//! Convert an integer to ruby. Values that mrb_int cannot hold, like those
+//! over 2^31 when mruby is built with MRB_INT32, become floats if the float
+//! holds them exactly. Otherwise, ie above 2^53 for a double mrb_float,
+//! raises a RangeError rather than silently losing precision, or throws
+//! mrb_exception if `mrb` is null.
+template <typename INT>
+mrb_value integer_value(INT i, mrb_state* mrb)
+{
+    if (int_fits(i)) { return mrb_int_value(mrb, static_cast<mrb_int>(i)); }
+    if (!integer_fits(i)) {
+        if (mrb == nullptr) {
+            throw mrb_exception("integer out of range for mrb_int and mrb_float");
+        }
+        mrb_raise(mrb, E_RANGE_ERROR,
+                  "integer out of range for mrb_int and mrb_float");
+    }
+    return mrb_float_value(mrb, static_cast<mrb_float>(i));
+}
+
 } // namespace mrb
 
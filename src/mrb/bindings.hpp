@@ -0,0 +1,158 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <tuple>
+#include <type_traits>
+
+namespace mrb {
+
+// Entries in a binding table. Names must be string literals; they are
+// interned without being copied.
+
+template <auto PTR>
+struct MethodEntry
+{
+    const char* name;
+};
+
+template <typename FN>
+struct FunctionEntry
+{
+    const char* name;
+    FN fn;
+};
+
+template <auto PTR>
+struct ReaderEntry
+{
+    const char* name;
+};
+
+template <auto PTR>
+struct WriterEntry
+{
+    const char* name;
+};
+
+template <auto PTR>
+struct AccessorEntry
+{
+    const char* name;
+};
+
+template <typename N>
+struct ConstantEntry
+{
+    const char* name;
+    N value;
+};
+
+//! A member function bound as a method
+template <auto PTR>
+constexpr MethodEntry<PTR> method(const char* name)
+{
+    return {name};
+}
+
+//! A callable taking the object as its first argument, bound as a method
+template <typename FN>
+constexpr FunctionEntry<FN> method(const char* name, FN fn)
+{
+    return {name, fn};
+}
+
+//! A field exposed with a reader, like attr_reader()
+template <auto PTR>
+constexpr ReaderEntry<PTR> reader(const char* name)
+{
+    return {name};
+}
+
+//! A field exposed with a writer called `name=`, like attr_writer()
+template <auto PTR>
+constexpr WriterEntry<PTR> writer(const char* name)
+{
+    return {name};
+}
+
+//! A field exposed with a reader and a writer, like attr_accessor()
+template <auto PTR>
+constexpr AccessorEntry<PTR> accessor(const char* name)
+{
+    return {name};
+}
+
+//! A constant defined in the class, like define_const()
+template <typename N>
+constexpr ConstantEntry<N> constant(const char* name, N value)
+{
+    return {name, value};
+}
+
+//! When the methods in a binding table are defined
+enum class Registration
+{
+    Eager, //!< All methods are defined by make_class()
+    Lazy   //!< Each method is defined the first time it is called
+};
+
+namespace detail {
+template <typename T, typename = void>
+struct member_registration
+{
+    static constexpr Registration value = Registration::Eager;
+};
+
+template <typename T>
+struct member_registration<T, std::void_t<decltype(T::registration)>>
+{
+    static constexpr Registration value = T::registration;
+};
+} // namespace detail
+
+// Bindings<T> is the binding table for T, which make_class() registers in
+// one pass together with the class. By default it is taken from a static
+// `bindings()` function in T, ie
+//
+//   struct Game {
+//       int score = 0;
+//       void add_score(int s) { score += s; }
+//       static constexpr auto bindings() {
+//           return std::tuple{mrb::method<&Game::add_score>("add_score"),
+//                             mrb::accessor<&Game::score>("score"),
+//                             mrb::constant("MAX_SCORE", 1000)};
+//       }
+//   };
+//
+// For types you can not change, specialize Bindings<T> instead and give it a
+// static `value` holding the table. Either form may also declare a static
+// `registration` to select Registration::Lazy.
+template <typename T, typename = void>
+struct Bindings
+{};
+
+template <typename T>
+struct Bindings<T, std::void_t<decltype(T::bindings())>>
+{
+    static constexpr auto value = T::bindings();
+    static constexpr Registration registration =
+        detail::member_registration<T>::value;
+};
+
+template <typename T, typename = void>
+struct has_bindings : std::false_type
+{};
+
+template <typename T>
+struct has_bindings<T, std::void_t<decltype(Bindings<T>::value)>>
+    : std::true_type
+{};
+
+template <typename T>
+constexpr Registration registration_of()
+{
+    return detail::member_registration<Bindings<T>>::value;
+}
+
+} // namespace mrb
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "base.hpp"
+#include "types.hpp"
+
+extern "C"
+{
+#include <mruby/gc.h>
+}
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mrb {
+
+//! The live objects of one class in a heap census
+struct CensusEntry
+{
+    size_t objects = 0;
+    size_t native_bytes = 0; //!< See set_native_size()
+};
+
+//! A count of the live objects on the heap of a state; see heap_census()
+struct HeapCensus
+{
+    //! Per native type registered with make_class(), by registered name
+    std::map<std::string, CensusEntry> native;
+    //! Per ruby class, for every object on the heap
+    std::map<std::string, CensusEntry> classes;
+    size_t objects = 0;
+    size_t native_bytes = 0;
+};
+
+//! The change of one entry between two censuses
+struct CensusChange
+{
+    std::string name;
+    ptrdiff_t objects = 0;
+    ptrdiff_t native_bytes = 0;
+};
+
+struct CensusDiff
+{
+    std::vector<CensusChange> native;
+    std::vector<CensusChange> classes;
+};
+
+namespace detail {
+
+struct CensusWalk
+{
+    std::unordered_map<DataType const*, CensusEntry> native;
+    std::unordered_map<RClass*, CensusEntry> classes;
+    size_t objects = 0;
+    size_t native_bytes = 0;
+};
+
+inline int census_object(mrb_state* mrb, RBasic* obj, void* data)
+{
+    if (obj->tt == MRB_TT_FREE || mrb_object_dead_p(mrb, obj)) {
+        return MRB_EACH_OBJ_OK;
+    }
+    auto& walk = *static_cast<CensusWalk*>(data);
+    size_t bytes = 0;
+    if (obj->tt == MRB_TT_DATA) {
+        auto* rdata = reinterpret_cast<RData*>(obj); // NOLINT
+        auto const* dt = data_type_of(rdata->type);
+        if (dt != nullptr && rdata->data != nullptr) {
+            auto const* info = dt->info;
+            if (info->native_size != nullptr) {
+                bytes = info->native_size(holder_ptr(dt, rdata->data));
+            }
+            // All holders of a type are counted together
+            auto& e = walk.native[&data_types[info->tag][0]];
+            e.objects++;
+            e.native_bytes += bytes;
+        }
+    }
+    auto& e = walk.classes[obj->c == nullptr ? nullptr : mrb_class_real(obj->c)];
+    e.objects++;
+    e.native_bytes += bytes;
+    walk.objects++;
+    walk.native_bytes += bytes;
+    return MRB_EACH_OBJ_OK;
+}
+
+inline std::vector<CensusChange>
+census_changes(std::map<std::string, CensusEntry> const& before,
+               std::map<std::string, CensusEntry> const& after)
+{
+    std::vector<CensusChange> changes;
+    auto add = [&](std::string const& name, CensusEntry const& b,
+                   CensusEntry const& a) {
+        auto objects = static_cast<ptrdiff_t>(a.objects) -
+                       static_cast<ptrdiff_t>(b.objects);
+        auto bytes = static_cast<ptrdiff_t>(a.native_bytes) -
+                     static_cast<ptrdiff_t>(b.native_bytes);
+        if (objects != 0 || bytes != 0) {
+            changes.push_back({name, objects, bytes});
+        }
+    };
+    for (auto const& [name, a] : after) {
+        auto it = before.find(name);
+        add(name, it == before.end() ? CensusEntry{} : it->second, a);
+    }
+    for (auto const& [name, b] : before) {
+        if (after.count(name) == 0) { add(name, b, CensusEntry{}); }
+    }
+    std::sort(changes.begin(), changes.end(), [](auto const& x, auto const& y) {
+        return x.objects > y.objects;
+    });
+    return changes;
+}
+
+} // namespace detail
+
+//! Count the live objects on the heap of `mrb`, per registered native type
+//! and per ruby class. Walking the heap makes mruby run a full collection
+//! first, so the cost is that of a full GC plus a pass over the heap.
+inline HeapCensus heap_census(mrb_state* mrb)
+{
+    detail::CensusWalk walk;
+    mrb_objspace_each_objects(mrb, &detail::census_object, &walk);
+
+    HeapCensus census;
+    census.objects = walk.objects;
+    census.native_bytes = walk.native_bytes;
+    // Types can share a name, like all container proxies, so they add up
+    for (auto const& [dt, e] : walk.native) {
+        auto& entry = census.native[dt->type.struct_name];
+        entry.objects += e.objects;
+        entry.native_bytes += e.native_bytes;
+    }
+    auto arena = mrb_gc_arena_save(mrb);
+    for (auto const& [cls, e] : walk.classes) {
+        const char* name = cls == nullptr ? nullptr : mrb_class_name(mrb, cls);
+        auto& entry = census.classes[name == nullptr ? "<internal>" : name];
+        entry.objects += e.objects;
+        entry.native_bytes += e.native_bytes;
+    }
+    mrb_gc_arena_restore(mrb, arena);
+    return census;
+}
+
+//! The entries that changed from `before` to `after`, the ones that grew
+//! the most first
+inline CensusDiff census_diff(HeapCensus const& before, HeapCensus const& after)
+{
+    return {detail::census_changes(before.native, after.native),
+            detail::census_changes(before.classes, after.classes)};
+}
+
+} // namespace mrb
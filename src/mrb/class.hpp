@@ -1,16 +1,29 @@
 #pragma once
 
+#include "alloc.hpp"
 #include "base.hpp"
+#include "bindings.hpp"
+#include "census.hpp"
 #include "conv.hpp"
+#include "gc.hpp"
 #include "get_args.hpp"
+#include "profiler.hpp"
+#include "proxy.hpp"
+#include "result.hpp"
+#include "stats.hpp"
 
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cctype>
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <numeric>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 namespace mrb {
@@ -26,59 +39,85 @@ constexpr const char* class_name()
     return CLASS::class_name();
 }
 
+// Declare BASES as the native base classes of T, and return the ruby class to
+// use as parent; `parent` if given, otherwise the class of the first base.
+template <typename T, typename... BASES>
+RClass* class_parent(mrb_state* mrb, RClass* parent)
+{
+    (add_base<T, BASES>(), ...);
+    if constexpr (sizeof...(BASES) > 0) {
+        if (parent == nullptr) {
+            using FIRST = std::tuple_element_t<0, std::tuple<BASES...>>;
+            parent = Lookup<FIRST>::rclasses[mrb].rclass;
+        }
+    }
+    return parent == nullptr ? mrb->object_class : parent;
+}
+
 template <typename T>
+void define_bindings(mrb_state* mrb, RClass* rclass);
+
+//! Expose a C++ class to ruby. BASES are native base classes of T that are
+//! also registered, so objects of T can be passed where a BASES* is expected.
+template <typename T, typename... BASES>
 RClass* make_class(mrb_state* mrb, const char* name = class_name<T>(),
                    RClass* parent = nullptr)
 {
-    if (parent == nullptr) {
-        parent = mrb->object_class;
-    }
+    parent = class_parent<T, BASES...>(mrb, parent);
     auto* rclass = mrb_define_class(mrb, name, parent);
-    Lookup<T>::rclasses[mrb] = {
-        rclass,
-        { name, [](mrb_state*, void* data) { delete static_cast<T*>(data); } } };
-    MRB_SET_INSTANCE_TT(rclass, MRB_TT_DATA);
+    register_class<T>(mrb, rclass, name);
     mrb_define_method(
         mrb, rclass, "initialize",
         [](mrb_state* mrb, mrb_value self) -> mrb_value {
-            // fmt::print("Initialize\n");
-            auto* rv = (RBasic*)self.w;
             auto* obj = new T();
             DATA_PTR(self) = (void*)obj;            // NOLINT
-            DATA_TYPE(self) = &Lookup<T>::rclasses[mrb].data_type; // NOLINT
+            DATA_TYPE(self) = data_type<T>(); // NOLINT
             return mrb_nil_value();
         },
         MRB_ARGS_NONE());
+    if constexpr (has_bindings<T>()) {
+        define_bindings<T>(mrb, rclass);
+    }
     return rclass;
 }
 
-template <typename T>
+template <typename T, typename... BASES>
 RClass* make_noinit_class(mrb_state* mrb, const char* name = class_name<T>(),
                           RClass* parent = nullptr)
 {
-    if (parent == nullptr) {
-        parent = mrb->object_class;
-    }
+    parent = class_parent<T, BASES...>(mrb, parent);
     auto* rclass = mrb_define_class(mrb, name, parent);
-    Lookup<T>::rclasses[mrb] = {
-        rclass,
-        { name, [](mrb_state*, void* data) { delete static_cast<T*>(data); } } };
-    MRB_SET_INSTANCE_TT(rclass, MRB_TT_DATA);
+    register_class<T>(mrb, rclass, name);
+    if constexpr (has_bindings<T>()) {
+        define_bindings<T>(mrb, rclass);
+    }
     return rclass;
 }
 
-template <typename T>
+//! Expose a C++ class whose objects are held by std::shared_ptr. Objects
+//! created with `new` from ruby are created with std::make_shared(), and can
+//! be passed to native functions taking a std::shared_ptr<T>.
+template <typename T, typename... BASES>
 RClass* make_shared_ptr_class(mrb_state* mrb, const char* name = class_name<T>(),
                           RClass* parent = nullptr)
 {
-    if (parent == nullptr) {
-        parent = mrb->object_class;
-    }
+    parent = class_parent<T, BASES...>(mrb, parent);
     auto* rclass = mrb_define_class(mrb, name, parent);
-    Lookup<T>::rclasses[mrb] = {
-        rclass,
-        { name, [](mrb_state*, void* data) { delete static_cast<T*>(data); } } };
-    MRB_SET_INSTANCE_TT(rclass, MRB_TT_DATA);
+    register_class<T>(mrb, rclass, name);
+    if constexpr (std::is_default_constructible_v<T>) {
+        mrb_define_method(
+            mrb, rclass, "initialize",
+            [](mrb_state* mrb, mrb_value self) -> mrb_value {
+                DATA_PTR(self) =
+                    new std::shared_ptr<void>(std::make_shared<T>());
+                DATA_TYPE(self) = data_type<T>(Holder::Shared);
+                return mrb_nil_value();
+            },
+            MRB_ARGS_NONE());
+    }
+    if constexpr (has_bindings<T>()) {
+        define_bindings<T>(mrb, rclass);
+    }
     return rclass;
 }
 
@@ -86,21 +125,35 @@ template <typename T>
 RClass* make_module(mrb_state* mrb, const char* name = class_name<T>())
 {
     auto* rclass = mrb_define_module(mrb, name);
-    Lookup<T>::rclasses[mrb] = { rclass, {} };
+    Lookup<T>::rclasses[mrb] = { rclass };
     return rclass;
 }
 
+//! Set the function that frees objects of T owned by ruby. It must not use
+//! the state it is given: objects that were later shared with native code
+//! (see shared_data_ptr()) are freed with a null state, possibly after the
+//! state is closed. The deleter belongs to the type, not to `mrb`, so it is
+//! used for objects of T in every state of the process.
 template <typename T, typename FN>
 void set_deleter(mrb_state* mrb, FN const& f)
 {
-    Lookup<T>::dts[mrb].dfree =
+    detail::data_types[type_info<T>().tag][0].type.dfree =
         reinterpret_cast<void (*)(mrb_state*, void*)>(+(f));
 }
 
+//! Set the function heap_census() uses for the bytes used by an object of
+//! T, ie for objects that own other memory. The default is sizeof(T).
+template <typename T, typename FN>
+void set_native_size(FN const& f)
+{
+    type_info<T>().native_size =
+        reinterpret_cast<size_t (*)(void const*)>(+(f));
+}
+
 template <typename T>
-mrb_data_type* get_data_type(mrb_state* mrb)
+mrb_data_type const* get_data_type(mrb_state* mrb)
 {
-    return &Lookup<T>::dts[mrb];
+    return data_type<T>();
 }
 
 template <typename T>
@@ -122,25 +175,133 @@ void define_const(mrb_state* ruby, std::string const& name, N value)
                      mrb::to_value(value, ruby));
 }
 
+//! Define a constant in CLASS for every named value of the enum E. Constant
+//! names are the upper cased enumerator names, and their values are the
+//! symbols the enum converts to.
+template <typename CLASS, typename E>
+void define_enum(mrb_state* ruby)
+{
+    static_assert(has_enum_names<E>(), "Enum has no name table");
+    for (auto const& e : Enums<E>::value) {
+        std::string name = e.name;
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) {
+                           return static_cast<char>(std::toupper(c));
+                       });
+        define_const<CLASS>(ruby, name, e.value);
+    }
+}
+
+namespace detail {
+
+template <typename FX>
+struct Callable
+{
+    static inline mrb_data_type const type{
+        "Callable", [](mrb_state*, void* p) { delete static_cast<FX*>(p); }};
+};
+
+// Create a proc for `func` that keeps a copy of the callable `fn` in its
+// environment. Every binding gets its own copy, so the same lambda type can
+// be bound with different captures, or in several states. With
+// MRB_BINDING_STATS or MRB_TRACE the counters of the binding are kept next
+// to it.
+template <typename FX>
+mrb_method_t callable_method(mrb_state* mrb, mrb_func_t func, FX const& fn,
+                             [[maybe_unused]] BindingCounters* counters)
+{
+    auto* data = mrb_data_object_alloc(mrb, mrb->object_class, new FX(fn),
+                                       &Callable<FX>::type);
+#ifdef MRB_CALL_PROBES
+    std::array<mrb_value, 2> env{mrb_obj_value(data),
+                                 mrb_cptr_value(mrb, counters)};
+#else
+    std::array<mrb_value, 1> env{mrb_obj_value(data)};
+#endif
+    auto* proc = mrb_proc_new_cfunc_with_env(
+        mrb, func, static_cast<mrb_int>(env.size()), env.data());
+    mrb_method_t m;
+    MRB_METHOD_FROM_PROC(m, proc);
+    return m;
+}
+
+//! The callable stored by callable_method() for the method being called
+template <typename FX>
+FX const& stored_callable(mrb_state* mrb)
+{
+    return *static_cast<FX const*>(DATA_PTR(mrb_proc_cfunc_env_get(mrb, 0)));
+}
+
+template <typename FX>
+void define_callable_method(mrb_state* mrb, RClass* cls, mrb_sym name,
+                            mrb_func_t func, FX const& fn,
+                            BindingCounters* counters)
+{
+    auto arena = mrb_gc_arena_save(mrb);
+    mrb_define_method_raw(mrb, cls, name,
+                          callable_method(mrb, func, fn, counters));
+    mrb_gc_arena_restore(mrb, arena);
+}
+
+template <typename FX>
+void define_callable_method(mrb_state* mrb, RClass* cls, mrb_sym name,
+                            mrb_func_t func, FX const& fn)
+{
+    define_callable_method(mrb, cls, name, func, fn,
+                           binding_counters(mrb, cls, name));
+}
+
+template <typename FX>
+void define_callable_method(mrb_state* mrb, RClass* cls,
+                            std::string const& name, mrb_func_t func,
+                            FX const& fn)
+{
+    define_callable_method(mrb, cls, mrb_intern_cstr(mrb, name.c_str()), func,
+                           fn);
+}
+
+template <typename FX>
+void define_callable_class_method(mrb_state* mrb, RClass* cls,
+                                  std::string const& name, mrb_func_t func,
+                                  FX const& fn)
+{
+    auto* meta = mrb_class_ptr(mrb_singleton_class(mrb, mrb_obj_value(cls)));
+    auto sym = mrb_intern_cstr(mrb, name.c_str());
+    define_callable_method(mrb, meta, sym, func, fn,
+                           binding_counters(mrb, cls, sym, '.'));
+}
+
+} // namespace detail
+
 template <typename FX, typename RET, typename... ARGS>
 void add_kernel_function(mrb_state* ruby, std::string const& name, FX const& fn,
                          RET (FX::*)(ARGS...) const)
 {
-    static FX _fn{fn};
-    mrb_define_module_function(
-        ruby, ruby->kernel_module, name.c_str(),
-        [](mrb_state* mrb, mrb_value) -> mrb_value {
-            FX fn{_fn};
-            auto args = mrb::get_args<ARGS...>(mrb);
-            if constexpr (std::is_same<RET, void>()) {
-                std::apply(fn, args);
-                return mrb_nil_value();
-            } else {
-                auto res = std::apply(fn, args);
-                return mrb::to_value(res, mrb);
-            }
-        },
-        MRB_ARGS_REQ(sizeof...(ARGS)));
+    auto func = [](mrb_state* mrb, mrb_value) -> mrb_value {
+        detail::CallProbe probe(mrb);
+        auto const& fn = detail::stored_callable<FX>(mrb);
+        auto args = mrb::get_args<ARGS...>(mrb);
+        probe.converted();
+        if constexpr (std::is_same<RET, void>()) {
+            std::apply(fn, args);
+            probe.called();
+            return mrb_nil_value();
+        } else {
+            decltype(auto) r = std::apply(fn, args);
+            probe.called();
+            return mrb::to_value(std::forward<decltype(r)>(r), mrb);
+        }
+    };
+    // Like mrb_define_module_function(), callable both as Kernel.name and
+    // from any object. Both methods share one set of counters, since they
+    // are the same binding.
+    auto* kernel = ruby->kernel_module;
+    auto sym = mrb_intern_cstr(ruby, name.c_str());
+    auto* counters = detail::binding_counters(ruby, kernel, sym);
+    auto* meta =
+        mrb_class_ptr(mrb_singleton_class(ruby, mrb_obj_value(kernel)));
+    detail::define_callable_method(ruby, meta, sym, func, fn, counters);
+    detail::define_callable_method(ruby, kernel, sym, func, fn, counters);
 }
 
 template <typename FN>
@@ -153,21 +314,24 @@ template <typename CLASS, typename FX, typename RET, typename... ARGS>
 void add_class_method(mrb_state* ruby, std::string const& name, FX const& fn,
                       RET (FX::*)(ARGS...) const)
 {
-    static FX _fn{fn};
-    mrb_define_class_method(
-        ruby, Lookup<CLASS>::rclasses[ruby].rclass, name.c_str(),
+    detail::define_callable_class_method(
+        ruby, Lookup<CLASS>::rclasses[ruby].rclass, name,
         [](mrb_state* mrb, mrb_value) -> mrb_value {
-            FX fn{_fn};
+            detail::CallProbe probe(mrb);
+            auto const& fn = detail::stored_callable<FX>(mrb);
             auto args = mrb::get_args<ARGS...>(mrb);
+            probe.converted();
             if constexpr (std::is_same<RET, void>()) {
                 std::apply(fn, args);
+                probe.called();
                 return mrb_nil_value();
             } else {
-                auto res = std::apply(fn, args);
-                return mrb::to_value(res, mrb);
+                decltype(auto) r = std::apply(fn, args);
+                probe.called();
+                return mrb::to_value(std::forward<decltype(r)>(r), mrb);
             }
         },
-        MRB_ARGS_REQ(sizeof...(ARGS)));
+        fn);
 }
 
 template <typename CLASS, typename FN>
@@ -176,31 +340,53 @@ void add_class_method(mrb_state* ruby, std::string const& name, FN const& fn)
     add_class_method<CLASS>(ruby, name, fn, &FN::operator());
 }
 
+namespace detail {
+
+// The call glue for methods bound to callables of type FX
+template <typename SELF, typename FX, typename RET, typename... ARGS>
+mrb_value method_thunk(mrb_state* mrb, mrb_value self)
+{
+    CallProbe probe(mrb);
+    auto const& fn = stored_callable<FX>(mrb);
+    auto args = mrb::get_args<ARGS...>(mrb);
+    auto&& ptr = mrb::self_to<SELF>(self);
+    probe.converted();
+    if constexpr (std::is_same<RET, void>()) {
+        std::apply(fn, std::tuple_cat(std::make_tuple(ptr), args));
+        probe.called();
+        return self;
+    } else {
+        decltype(auto) r =
+            std::apply(fn, std::tuple_cat(std::make_tuple(ptr), args));
+        probe.called();
+        return mrb::to_value(std::forward<decltype(r)>(r), mrb);
+    }
+}
+
+template <typename SELF, typename FX, typename RET, typename... ARGS>
+constexpr mrb_func_t method_thunk_for(RET (FX::*)(SELF, ARGS...) const)
+{
+    return &method_thunk<SELF, FX, RET, ARGS...>;
+}
+
+template <typename FX>
+void define_method(mrb_state* mrb, RClass* cls, mrb_sym name, FX const& fn)
+{
+    define_callable_method(mrb, cls, name, method_thunk_for(&FX::operator()),
+                           fn);
+}
+
+} // namespace detail
+
 template <typename CLASS, typename SELF, typename FX, typename RET,
           typename... ARGS>
 void add_method(mrb_state* ruby, std::string const& name, FX const& fn,
                 RET (FX::*)(SELF, ARGS...) const)
 {
-    static FX _fn{fn};
     auto* lu = Lookup<CLASS>::rclasses[ruby].rclass;
     if (lu == nullptr) { throw mrb_exception("Adding method to unregistered class"); }
-    mrb_define_method(
-        ruby, lu, name.c_str(),
-        [](mrb_state* mrb, mrb_value self) -> mrb_value {
-            FX fn{_fn};
-            auto args = mrb::get_args<ARGS...>(mrb);
-            auto&& ptr = mrb::self_to<SELF>(self);
-            if constexpr (std::is_same<RET, void>()) {
-                std::apply(fn, std::tuple_cat(std::make_tuple(ptr), args));
-                return self;
-                // return mrb_nil_value();
-            } else {
-                return mrb::to_value(
-                    std::apply(fn, std::tuple_cat(std::make_tuple(ptr), args)),
-                    mrb);
-            }
-        },
-        MRB_ARGS_REQ(sizeof...(ARGS)));
+    detail::define_callable_method(
+        ruby, lu, name, &detail::method_thunk<SELF, FX, RET, ARGS...>, fn);
 }
 
 template <typename CLASS, typename FN>
@@ -209,23 +395,265 @@ void add_method(mrb_state* ruby, std::string const& name, FN const& fn)
     add_method<CLASS>(ruby, name, fn, &FN::operator());
 }
 
+namespace detail {
+
+// One entry in the dispatch table of an overload set
+struct OverloadEntry
+{
+    bool (*match)(mrb_value const* argv, mrb_int argc, bool exact);
+    mrb_value (*call)(mrb_state* mrb, mrb_value self, mrb_value const* argv,
+                      mrb_int argc);
+};
+
+template <typename MFN>
+struct Overload;
+
+template <typename FX, typename SELF, typename RET, typename... ARGS>
+struct Overload<RET (FX::*)(SELF, ARGS...) const>
+{
+    template <size_t... I>
+    static bool match(mrb_value const* argv, mrb_int argc, bool exact)
+    {
+        constexpr auto min = static_cast<mrb_int>(required_args<ARGS...>());
+        if (argc < min || argc > static_cast<mrb_int>(sizeof...(ARGS))) {
+            return false;
+        }
+        return (true && ... &&
+                (static_cast<mrb_int>(I) >= argc ||
+                 value_is<std::decay_t<ARGS>>(argv[I], exact)));
+    }
+
+    // SET is the tuple of callables stored with the method, and N the
+    // position of this overload in it
+    template <typename SET, size_t N, size_t... I>
+    static mrb_value call(mrb_state* mrb, mrb_value self,
+                          mrb_value const* argv, mrb_int argc)
+    {
+        // Braced init, so arguments are converted left to right
+        std::tuple<std::decay_t<ARGS>...> args{value_to<std::decay_t<ARGS>>(
+            static_cast<mrb_int>(I) < argc ? argv[I] : mrb_nil_value(),
+            mrb)...};
+        auto const& fn = std::get<N>(stored_callable<SET>(mrb));
+        auto&& ptr = mrb::self_to<SELF>(self);
+        if constexpr (std::is_same<RET, void>()) {
+            std::invoke(fn, ptr, std::get<I>(args)...);
+            return self;
+        } else {
+            return mrb::to_value(std::invoke(fn, ptr, std::get<I>(args)...),
+                                 mrb);
+        }
+    }
+
+    template <typename SET, size_t N, size_t... I>
+    static constexpr OverloadEntry entry(std::index_sequence<I...>)
+    {
+        return {&match<I...>, &call<SET, N, I...>};
+    }
+
+    template <typename SET, size_t N>
+    static constexpr OverloadEntry entry()
+    {
+        return entry<SET, N>(std::index_sequence_for<ARGS...>());
+    }
+};
+
+template <typename CLASS, typename... FNS, size_t... N>
+void add_overloads(mrb_state* ruby, std::string const& name,
+                   std::index_sequence<N...>, FNS const&... fns)
+{
+    using Set = std::tuple<FNS...>;
+    static constexpr std::array<OverloadEntry, sizeof...(FNS)> table{
+        Overload<decltype(&FNS::operator())>::template entry<Set, N>()...};
+    auto* lu = Lookup<CLASS>::rclasses[ruby].rclass;
+    if (lu == nullptr) { throw mrb_exception("Adding method to unregistered class"); }
+    define_callable_method(
+        ruby, lu, name,
+        [](mrb_state* mrb, mrb_value self) -> mrb_value {
+            // Overloads convert their own arguments, so this is all
+            // counted as native time
+            CallProbe probe(mrb);
+            probe.converted();
+            auto argc = mrb_get_argc(mrb);
+            auto const* argv = mrb_get_argv(mrb);
+            for (bool exact : {true, false}) {
+                for (auto const& entry : table) {
+                    if (entry.match(argv, argc, exact)) {
+                        auto res = entry.call(mrb, self, argv, argc);
+                        probe.called();
+                        return res;
+                    }
+                }
+            }
+            mrb_raisef(mrb, E_ARGUMENT_ERROR,
+                       "no overload of '%n' matches the arguments",
+                       mrb_get_mid(mrb));
+            return mrb_nil_value();
+        },
+        Set{fns...});
+}
+
+} // namespace detail
+
+//! Bind several callables to one ruby method name. A call goes to the first
+//! overload whose arity and argument types match the ruby arguments
+//! exactly, or failing that the first one they convert to (see value_is()).
+//! The dispatch table is built at compile time, one entry per overload.
+//!
+//! mrb::add_overloads<Canvas>(ruby, "draw",
+//!     [](Canvas* c, int x, int y) { c->plot(x, y); },
+//!     [](Canvas* c, std::string const& text) { c->print(text); });
+template <typename CLASS, typename... FNS>
+void add_overloads(mrb_state* ruby, std::string const& name, FNS const&... fns)
+{
+    detail::add_overloads<CLASS>(ruby, name, std::index_sequence_for<FNS...>(),
+                                 fns...);
+}
+
+namespace detail {
+
+// Callables for member pointers. Only the signature of the member is part
+// of the type: the member pointer is kept as bytes, and the class is only
+// known to the small `self` and `invoke` functions. So members of any class
+// with the same argument and return types share one instantiation of the
+// call glue, argument conversion included.
+template <typename RET, typename... ARGS>
+struct MemberCall
+{
+    using Storage = std::array<unsigned char, 4 * sizeof(void*)>;
+
+    void* (*self)(mrb_value);
+    RET (*invoke)(Storage const& member, void* obj, ARGS... args);
+    Storage member{};
+};
+
+template <typename CLASS>
+void* member_self(mrb_value self)
+{
+    return mrb::self_to<CLASS*>(self);
+}
+
+template <typename MP>
+MP member_ptr(unsigned char const* bytes)
+{
+    MP ptr{};
+    std::memcpy(&ptr, bytes, sizeof(ptr));
+    return ptr;
+}
+
+template <typename CLASS, typename MFP, typename RET, typename... ARGS>
+RET invoke_member_fn(
+    typename MemberCall<RET, ARGS...>::Storage const& member, void* obj,
+    ARGS... args)
+{
+    auto ptr = member_ptr<MFP>(member.data());
+    return (static_cast<CLASS*>(obj)->*ptr)(std::forward<ARGS>(args)...);
+}
+
+template <typename CLASS, typename M>
+M invoke_member_get(typename MemberCall<M>::Storage const& member, void* obj)
+{
+    return static_cast<CLASS*>(obj)->*member_ptr<M CLASS::*>(member.data());
+}
+
+template <typename CLASS, typename M>
+void invoke_member_set(typename MemberCall<void, M>::Storage const& member,
+                       void* obj, M v)
+{
+    static_cast<CLASS*>(obj)->*member_ptr<M CLASS::*>(member.data()) =
+        std::move(v);
+}
+
+template <typename CLASS, typename MP, typename RET, typename... ARGS>
+MemberCall<RET, ARGS...> member_call(
+    MP ptr, RET (*invoke)(typename MemberCall<RET, ARGS...>::Storage const&,
+                          void*, ARGS...))
+{
+    MemberCall<RET, ARGS...> call{&member_self<CLASS>, invoke};
+    static_assert(sizeof(MP) <= sizeof(call.member),
+                  "member pointer too large");
+    std::memcpy(call.member.data(), &ptr, sizeof(ptr));
+    return call;
+}
+
+template <typename CLASS, typename RET, typename... ARGS>
+MemberCall<RET, ARGS...> member_fn(RET (CLASS::*ptr)(ARGS...))
+{
+    return member_call<CLASS>(
+        ptr, &invoke_member_fn<CLASS, decltype(ptr), RET, ARGS...>);
+}
+
+template <typename CLASS, typename RET, typename... ARGS>
+MemberCall<RET, ARGS...> member_fn(RET (CLASS::*ptr)(ARGS...) const)
+{
+    return member_call<CLASS>(
+        ptr, &invoke_member_fn<CLASS, decltype(ptr), RET, ARGS...>);
+}
+
+template <typename CLASS, typename M>
+MemberCall<M> member_get(M CLASS::*ptr)
+{
+    return member_call<CLASS>(ptr, &invoke_member_get<CLASS, M>);
+}
+
+template <typename CLASS, typename M>
+MemberCall<void, M> member_set(M CLASS::*ptr)
+{
+    return member_call<CLASS>(ptr, &invoke_member_set<CLASS, M>);
+}
+
+// The call glue for methods bound to member pointers
+template <typename RET, typename... ARGS>
+mrb_value member_thunk(mrb_state* mrb, mrb_value self)
+{
+    CallProbe probe(mrb);
+    auto const& fn = stored_callable<MemberCall<RET, ARGS...>>(mrb);
+    auto args = mrb::get_args<ARGS...>(mrb);
+    auto* obj = fn.self(self);
+    probe.converted();
+    auto call = [&](auto&&... a) -> RET {
+        return fn.invoke(fn.member, obj, std::forward<decltype(a)>(a)...);
+    };
+    if constexpr (std::is_same<RET, void>()) {
+        std::apply(call, args);
+        probe.called();
+        return self;
+    } else {
+        decltype(auto) r = std::apply(call, args);
+        probe.called();
+        return mrb::to_value(std::forward<decltype(r)>(r), mrb);
+    }
+}
+
+template <typename RET, typename... ARGS>
+void define_member(mrb_state* mrb, RClass* cls, mrb_sym name,
+                   MemberCall<RET, ARGS...> const& call)
+{
+    define_callable_method(mrb, cls, name, &member_thunk<RET, ARGS...>, call);
+}
+
+template <typename CLASS, typename RET, typename... ARGS>
+void add_member(mrb_state* ruby, std::string const& name,
+                MemberCall<RET, ARGS...> const& call)
+{
+    auto* lu = Lookup<CLASS>::rclasses[ruby].rclass;
+    if (lu == nullptr) { throw mrb_exception("Adding method to unregistered class"); }
+    define_member(ruby, lu, mrb_intern_cstr(ruby, name.c_str()), call);
+}
+
+} // namespace detail
+
 template <auto PTR, typename CLASS, typename M, typename... ARGS>
 void add_method2(mrb_state* ruby, std::string const& name,
                  M (CLASS::*)(ARGS...) const)
 {
-    add_method<CLASS>(ruby, name, [](CLASS* c, ARGS... args) {
-        // return c->*PTR(args...);
-        return std::invoke(PTR, c, args...);
-    });
+    detail::add_member<CLASS>(ruby, name, detail::member_fn(PTR));
 }
 
 template <auto PTR, typename CLASS, typename M, typename... ARGS>
 void add_method2(mrb_state* ruby, std::string const& name,
                  M (CLASS::*)(ARGS...))
 {
-    add_method<CLASS>(ruby, name, [](CLASS* c, ARGS... args) {
-        return std::invoke(PTR, c, args...);
-    });
+    detail::add_member<CLASS>(ruby, name, detail::member_fn(PTR));
 }
 
 template <auto PTR>
@@ -237,8 +665,8 @@ void add_method(mrb_state* ruby, std::string const& name)
 template <auto PTR, typename CLASS, typename M>
 void attr_accessor(mrb_state* ruby, std::string const& name, M CLASS::*)
 {
-    add_method<CLASS>(ruby, name, [](CLASS* c) { return c->*PTR; });
-    add_method<CLASS>(ruby, name + "=", [](CLASS* c, M v) { c->*PTR = v; });
+    detail::add_member<CLASS>(ruby, name, detail::member_get(PTR));
+    detail::add_member<CLASS>(ruby, name + "=", detail::member_set(PTR));
 }
 
 template <auto PTR>
@@ -250,7 +678,7 @@ void attr_accessor(mrb_state* ruby, std::string const& name)
 template <auto PTR, typename CLASS, typename M>
 void attr_reader(mrb_state* ruby, std::string const& name, M CLASS::*)
 {
-    add_method<CLASS>(ruby, name, [](CLASS* c) { return c->*PTR; });
+    detail::add_member<CLASS>(ruby, name, detail::member_get(PTR));
 }
 
 template <auto PTR>
@@ -259,15 +687,480 @@ void attr_reader(mrb_state* ruby, std::string const& name)
     attr_reader<PTR>(ruby, name, PTR);
 }
 
+template <auto PTR, typename CLASS, typename M>
+void attr_writer(mrb_state* ruby, std::string const& name, M CLASS::*)
+{
+    detail::add_member<CLASS>(ruby, name + "=", detail::member_set(PTR));
+}
+
+template <auto PTR>
+void attr_writer(mrb_state* ruby, std::string const& name)
+{
+    attr_writer<PTR>(ruby, name, PTR);
+}
+
+namespace detail {
+
+// The container field a proxy accessor reads, kept in its proc environment
+template <typename CLASS, typename M>
+struct ProxyMember
+{
+    M CLASS::*ptr;
+};
+
+template <typename CLASS, typename M>
+mrb_value proxy_thunk(mrb_state* mrb, mrb_value self)
+{
+    CallProbe probe(mrb);
+    auto const& member = stored_callable<ProxyMember<CLASS, M>>(mrb);
+    mrb::get_args<>(mrb);
+    auto* ptr = mrb::self_to<CLASS*>(self);
+    probe.converted();
+    auto proxy = make_proxy(mrb, &(ptr->*member.ptr), self);
+    probe.called();
+    return proxy;
+}
+
+} // namespace detail
+
+template <auto PTR, typename CLASS, typename M>
+void attr_proxy(mrb_state* ruby, std::string const& name, M CLASS::*)
+{
+    auto* lu = Lookup<CLASS>::rclasses[ruby].rclass;
+    if (lu == nullptr) { throw mrb_exception("Adding method to unregistered class"); }
+    detail::define_callable_method(ruby, lu, name,
+                                   &detail::proxy_thunk<CLASS, M>,
+                                   detail::ProxyMember<CLASS, M>{PTR});
+}
+
+//! Expose a container field as a proxy object. Unlike attr_reader(), the
+//! container is not copied; ruby reads and writes the native container
+//! directly through `[]`, `[]=`, `size`, `each` and `keys`.
+template <auto PTR>
+void attr_proxy(mrb_state* ruby, std::string const& name)
+{
+    attr_proxy<PTR>(ruby, name, PTR);
+}
+
+namespace detail {
+
+// The symbol for the writer of `name`, ie `name=`
+inline mrb_sym writer_sym(mrb_state* mrb, const char* name)
+{
+    std::array<char, 64> buf{};
+    auto len = std::strlen(name);
+    if (len + 1 > buf.size()) {
+        return mrb_intern_cstr(mrb, (std::string(name) + "=").c_str());
+    }
+    std::memcpy(buf.data(), name, len);
+    buf[len] = '=';
+    return mrb_intern(mrb, buf.data(), len + 1);
+}
+
+template <typename E>
+mrb_sym entry_sym(mrb_state* mrb, E const& e)
+{
+    return mrb_intern_static(mrb, e.name, std::strlen(e.name));
+}
+
+template <auto PTR>
+mrb_sym entry_sym(mrb_state* mrb, WriterEntry<PTR> const& e)
+{
+    return writer_sym(mrb, e.name);
+}
+
+template <auto PTR>
+void define_entry(mrb_state* mrb, RClass* rclass, mrb_sym sym,
+                  MethodEntry<PTR> const&)
+{
+    define_member(mrb, rclass, sym, member_fn(PTR));
+}
+
+template <typename FN>
+void define_entry(mrb_state* mrb, RClass* rclass, mrb_sym sym,
+                  FunctionEntry<FN> const& e)
+{
+    define_method(mrb, rclass, sym, e.fn);
+}
+
+template <auto PTR>
+void define_entry(mrb_state* mrb, RClass* rclass, mrb_sym sym,
+                  ReaderEntry<PTR> const&)
+{
+    define_member(mrb, rclass, sym, member_get(PTR));
+}
+
+template <auto PTR>
+void define_entry(mrb_state* mrb, RClass* rclass, mrb_sym sym,
+                  WriterEntry<PTR> const&)
+{
+    define_member(mrb, rclass, sym, member_set(PTR));
+}
+
+template <auto PTR>
+void define_entry(mrb_state* mrb, RClass* rclass, mrb_sym sym,
+                  AccessorEntry<PTR> const& e)
+{
+    define_member(mrb, rclass, sym, member_get(PTR));
+    define_member(mrb, rclass, writer_sym(mrb, e.name), member_set(PTR));
+}
+
+template <typename N>
+void define_entry(mrb_state* mrb, RClass* rclass, mrb_sym sym,
+                  ConstantEntry<N> const& e)
+{
+    mrb_const_set(mrb, mrb_obj_value(rclass), sym, to_value(e.value, mrb));
+}
+
+} // namespace detail
+
+namespace detail {
+
+template <typename E>
+constexpr bool is_constant_entry(E const&)
+{
+    return false;
+}
+
+template <typename N>
+constexpr bool is_constant_entry(ConstantEntry<N> const&)
+{
+    return true;
+}
+
+template <typename E>
+constexpr bool has_writer(E const&)
+{
+    return false;
+}
+
+template <auto PTR>
+constexpr bool has_writer(WriterEntry<PTR> const&)
+{
+    return true;
+}
+
+template <auto PTR>
+constexpr bool has_writer(AccessorEntry<PTR> const&)
+{
+    return true;
+}
+
+template <auto PTR>
+constexpr bool has_reader(WriterEntry<PTR> const&)
+{
+    return false;
+}
+
+template <typename E>
+constexpr bool has_reader(E const& e)
+{
+    return !is_constant_entry(e);
+}
+
+// The methods of a lazily registered binding table, sorted by name so the
+// entry for a missing method can be found with a binary search
+template <typename T>
+struct LazyTable
+{
+    struct Name
+    {
+        std::string_view name;
+        bool writer; // True for `name=`
+        size_t entry;
+
+        bool operator<(Name const& other) const
+        {
+            return std::tie(name, writer) < std::tie(other.name, other.writer);
+        }
+    };
+
+    using Definer = void (*)(mrb_state*, RClass*);
+
+    template <size_t... I>
+    static constexpr auto make_definers(std::index_sequence<I...>)
+    {
+        return std::array<Definer, sizeof...(I)>{
+            [](mrb_state* mrb, RClass* rclass) {
+                auto const& e = std::get<I>(Bindings<T>::value);
+                define_entry(mrb, rclass, entry_sym(mrb, e), e);
+            }...};
+    }
+
+    static constexpr auto definers =
+        make_definers(std::make_index_sequence<std::tuple_size_v<
+                          std::remove_const_t<decltype(Bindings<T>::value)>>>());
+
+    static std::vector<Name> const& names()
+    {
+        static std::vector<Name> const sorted = [] {
+            std::vector<Name> result;
+            auto add = [&](auto const& e, size_t i) {
+                if (has_reader(e)) {
+                    result.push_back({e.name, false, i});
+                }
+                if (has_writer(e)) {
+                    result.push_back({e.name, true, i});
+                }
+            };
+            std::apply(
+                [&](auto const&... e) {
+                    size_t i = 0;
+                    (add(e, i++), ...);
+                },
+                Bindings<T>::value);
+            std::sort(result.begin(), result.end());
+            return result;
+        }();
+        return sorted;
+    }
+
+    // The index of the entry defining the method `name`, or -1
+    static int find(std::string_view name)
+    {
+        auto const& sorted = names();
+        auto lookup = [&](Name const& key) {
+            auto it = std::lower_bound(sorted.begin(), sorted.end(), key);
+            return it != sorted.end() && it->name == key.name &&
+                           it->writer == key.writer
+                       ? static_cast<int>(it->entry)
+                       : -1;
+        };
+        auto i = lookup({name, false, 0});
+        if (i < 0 && name.size() > 1 && name.back() == '=') {
+            i = lookup({name.substr(0, name.size() - 1), true, 0});
+        }
+        return i;
+    }
+
+    static int find(mrb_state* mrb, mrb_sym sym)
+    {
+        mrb_int len = 0;
+        auto const* name = mrb_sym_name_len(mrb, sym, &len);
+        return find(std::string_view(name, static_cast<size_t>(len)));
+    }
+};
+
+// Pass the current call of `mid` on to the next definition above `cls`, the
+// way `super` would, and store what it returns in `result`. False if no
+// ancestor defines `mid`. A method defined in ruby is called with `argv`,
+// but without the block.
+inline bool call_super(mrb_state* mrb, RClass* cls, mrb_sym mid,
+                       mrb_value self, mrb_int argc, mrb_value const* argv,
+                       mrb_value& result)
+{
+    auto* super = cls->super;
+    if (super == nullptr) { return false; }
+    auto m = mrb_method_search_vm(mrb, &super, mid);
+    if (MRB_METHOD_UNDEF_P(m)) { return false; }
+    if (MRB_METHOD_FUNC_P(m)) {
+        // Plain C functions read their arguments from the current call
+        result = MRB_METHOD_FUNC(m)(mrb, self);
+    } else {
+        auto* proc = const_cast<RProc*>(MRB_METHOD_PROC(m)); // NOLINT
+        result = mrb_yield_with_class(mrb, mrb_obj_value(proc), argc, argv,
+                                      self, super);
+    }
+    return true;
+}
+
+// Define the missing method on the class, then call it. Names that are not
+// in the table go to the method_missing of the superclass, which may be the
+// lazy table of a base class.
+template <typename T>
+mrb_value lazy_method_missing(mrb_state* mrb, mrb_value self)
+{
+    mrb_sym name = 0;
+    mrb_value const* argv = nullptr;
+    mrb_int argc = 0;
+    mrb_value blk;
+    mrb_get_args(mrb, "n*&", &name, &argv, &argc, &blk);
+    auto* rclass = Lookup<T>::rclasses[mrb].rclass;
+    auto i = LazyTable<T>::find(mrb, name);
+    if (i >= 0) {
+        LazyTable<T>::definers[i](mrb, rclass);
+        return mrb_funcall_with_block(mrb, self, name, argc, argv, blk);
+    }
+    std::vector<mrb_value> args{mrb_symbol_value(name)};
+    args.insert(args.end(), argv, argv + argc);
+    mrb_value result;
+    if (call_super(mrb, rclass, sym<names::method_missing>(mrb), self,
+                   static_cast<mrb_int>(args.size()), args.data(), result)) {
+        return result;
+    }
+    mrb_raisef(mrb, E_NOMETHOD_ERROR, "undefined method '%n' for %T", name,
+               self);
+    return mrb_nil_value();
+}
+
+template <typename T>
+mrb_value lazy_respond_to_missing(mrb_state* mrb, mrb_value self)
+{
+    mrb_sym name = 0;
+    mrb_bool priv = false;
+    mrb_get_args(mrb, "n|b", &name, &priv);
+    if (LazyTable<T>::find(mrb, name) >= 0) { return mrb_true_value(); }
+    std::array<mrb_value, 2> args{mrb_symbol_value(name), mrb_bool_value(priv)};
+    mrb_value result;
+    if (call_super(mrb, Lookup<T>::rclasses[mrb].rclass,
+                   sym<names::respond_to_missing>(mrb), self,
+                   static_cast<mrb_int>(args.size()), args.data(), result)) {
+        return result;
+    }
+    return mrb_false_value();
+}
+
+// True if the class already has a method with one of the names of `e`, from
+// Object or Kernel say. method_missing never sees those names, so such
+// entries are defined up front.
+template <typename E>
+bool shadowed_entry(mrb_state* mrb, RClass* rclass, E const& e)
+{
+    if (is_constant_entry(e)) { return false; }
+    return (has_reader(e) &&
+            mrb_obj_respond_to(mrb, rclass, entry_sym(mrb, e))) ||
+           (has_writer(e) &&
+            mrb_obj_respond_to(mrb, rclass, writer_sym(mrb, e.name)));
+}
+
+// Only constants, and methods named like ones the class inherits, are
+// defined up front. Other methods are defined by method_missing the first
+// time they are called, so creating a state costs nothing for methods a
+// script never uses.
+template <typename T>
+void define_lazy_bindings(mrb_state* mrb, RClass* rclass)
+{
+    std::apply(
+        [&](auto const&... e) {
+            ((is_constant_entry(e) || shadowed_entry(mrb, rclass, e)
+                  ? define_entry(mrb, rclass, entry_sym(mrb, e), e)
+                  : void()),
+             ...);
+        },
+        Bindings<T>::value);
+    mrb_define_method(mrb, rclass, "method_missing", &lazy_method_missing<T>,
+                      MRB_ARGS_ANY());
+    mrb_define_method(mrb, rclass, "respond_to_missing?",
+                      &lazy_respond_to_missing<T>, MRB_ARGS_ARG(1, 1));
+}
+
+} // namespace detail
+
+//! Register the binding table of T (see bindings.hpp) in `rclass`. All
+//! names are interned first, then everything is defined in one pass without
+//! going through Lookup. Called by make_class() for types with a table.
+//! With Registration::Lazy, methods are instead defined on first use.
+template <typename T>
+void define_bindings(mrb_state* mrb, RClass* rclass)
+{
+    if constexpr (registration_of<T>() == Registration::Lazy) {
+        detail::define_lazy_bindings<T>(mrb, rclass);
+        return;
+    }
+    auto const& table = Bindings<T>::value;
+    constexpr auto N = std::tuple_size_v<std::remove_const_t<
+        std::remove_reference_t<decltype(Bindings<T>::value)>>>;
+    std::array<mrb_sym, N> syms{};
+    std::apply(
+        [&](auto const&... e) {
+            size_t i = 0;
+            ((syms[i++] = detail::entry_sym(mrb, e)), ...);
+        },
+        table);
+    auto arena = mrb_gc_arena_save(mrb);
+    std::apply(
+        [&](auto const&... e) {
+            size_t i = 0;
+            ((detail::define_entry(mrb, rclass, syms[i++], e),
+              mrb_gc_arena_restore(mrb, arena)),
+             ...);
+        },
+        table);
+}
+
 
 
 struct mruby
 {
     std::shared_ptr<mrb_state> ruby;
+    std::shared_ptr<Allocator> allocator;
+    std::shared_ptr<Profiler> profiler;
 
     mrb_state* ptr() { return ruby.get(); }
 
-    mruby() { ruby = std::shared_ptr<mrb_state>(mrb_open()); }
+    mruby() : ruby(mrb_open(), mrb_close)
+    {
+        if (!ruby) { throw mrb_exception("Could not open ruby state"); }
+    }
+
+    //! Open a state that gets its memory from `alloc`. The allocator is kept
+    //! alive until the state is closed.
+    explicit mruby(std::shared_ptr<Allocator> alloc)
+        : ruby(mrb_open_allocf(&Allocator::allocf, alloc.get()),
+               [alloc](mrb_state* mrb) { mrb_close(mrb); }),
+          allocator(std::move(alloc))
+    {
+        if (!ruby) { throw mrb_exception("Could not open ruby state"); }
+    }
+
+    //! Memory use of the state, if it was opened with an allocator
+    [[nodiscard]] MemoryStats memory() const
+    {
+        return allocator ? allocator->stats() : MemoryStats{};
+    }
+
+    void gc_mode(GcMode mode) { mrb::gc_set_mode(ruby.get(), mode); }
+    [[nodiscard]] GcMode gc_mode() const { return mrb::gc_mode(ruby.get()); }
+
+    void gc_interval_ratio(int ratio)
+    {
+        mrb::gc_set_interval_ratio(ruby.get(), ratio);
+    }
+
+    void gc_step_ratio(int ratio) { mrb::gc_set_step_ratio(ruby.get(), ratio); }
+
+    GcPause gc_step(std::chrono::nanoseconds budget)
+    {
+        return mrb::gc_step(ruby.get(), budget);
+    }
+
+    GcPause gc_full() { return mrb::gc_full(ruby.get()); }
+
+    [[nodiscard]] GcStats gc_stats() const { return mrb::gc_stats(ruby.get()); }
+
+    //! Count the live objects on the heap; see mrb::heap_census()
+    [[nodiscard]] HeapCensus heap_census() const
+    {
+        return mrb::heap_census(ruby.get());
+    }
+
+    [[nodiscard]] std::vector<BindingStat> binding_stats() const
+    {
+        return mrb::binding_stats(ruby.get());
+    }
+
+    //! Start sampling the ruby call stack every `interval`; see Profiler
+    void start_profiler(std::chrono::microseconds interval =
+                            std::chrono::milliseconds(1))
+    {
+        profiler = std::make_shared<Profiler>(ruby.get(), interval);
+        profiler->start();
+    }
+
+    //! Stop the profiler, and return its samples as collapsed stacks
+    std::string stop_profiler()
+    {
+        if (!profiler) { return {}; }
+        profiler->stop();
+        auto stacks = profiler->collapsed();
+        profiler = nullptr;
+        return stacks;
+    }
+
+    void gc_on_pause(std::function<void(GcPause const&)> fn)
+    {
+        mrb::gc_on_pause(ruby.get(), std::move(fn));
+    }
 
     template <auto PTR>
     void add_class_method(std::string const& name)
@@ -293,18 +1186,32 @@ struct mruby
         mrb::add_method<CLASS>(ruby.get(), name, fn, &FN::operator());
     }
 
-    template <typename T>
+    template <typename CLASS, typename... FNS>
+    void add_overloads(std::string const& name, FNS const&... fns)
+    {
+        mrb::add_overloads<CLASS>(ruby.get(), name, fns...);
+    }
+
+    template <typename T, typename... BASES>
     RClass* make_class(const char* name = class_name<T>(),
                        RClass* parent = nullptr)
     {
-        return mrb::make_class<T>(ruby.get(), name, parent);
+        return mrb::make_class<T, BASES...>(ruby.get(), name, parent);
     }
 
-    template <typename T>
+    template <typename T, typename... BASES>
     RClass* make_noinit_class(const char* name = class_name<T>(),
                        RClass* parent = nullptr)
     {
-        return mrb::make_class<T>(ruby.get(), name, parent);
+        return mrb::make_noinit_class<T, BASES...>(ruby.get(), name, parent);
+    }
+
+    template <typename T, typename... BASES>
+    RClass* make_shared_ptr_class(const char* name = class_name<T>(),
+                       RClass* parent = nullptr)
+    {
+        return mrb::make_shared_ptr_class<T, BASES...>(ruby.get(), name,
+                                                       parent);
     }
 
     template <auto PTR>
@@ -313,11 +1220,23 @@ struct mruby
         mrb::attr_reader<PTR>(ruby.get(), name, PTR);
     }
 
+    template <auto PTR>
+    void attr_writer(std::string const& name)
+    {
+        mrb::attr_writer<PTR>(ruby.get(), name, PTR);
+    }
+
     template <auto PTR>
     void attr_accessor(std::string const& name)
     {
         mrb::attr_accessor<PTR>(ruby.get(), name, PTR);
     }
+
+    template <auto PTR>
+    void attr_proxy(std::string const& name)
+    {
+        mrb::attr_proxy<PTR>(ruby.get(), name, PTR);
+    }
     template <typename T, typename FN>
     void set_deleter(mrb_state* mrb, FN const& f)
     {
@@ -327,7 +1246,13 @@ struct mruby
     template <typename CLASS, typename N>
     void define_const(std::string const& name, N value)
     {
-        mrb::define_const<CLASS, N>(name, value);
+        mrb::define_const<CLASS, N>(ruby.get(), name, value);
+    }
+
+    template <typename CLASS, typename E>
+    void define_enum()
+    {
+        mrb::define_enum<CLASS, E>(ruby.get());
     }
 
     template <typename FN>
@@ -336,9 +1261,11 @@ struct mruby
         mrb::add_kernel_function(ruby.get(), name, fn, &FN::operator());
     }
 
-    void exec(std::string const& code, const char* file_name = nullptr) const
+    //! Run `code`, returning the value of the last expression or the
+    //! exception it raised
+    [[nodiscard]] Result<mrb_value> try_exec(std::string const& code,
+                                             const char* file_name = nullptr) const
     {
-        //mrb_load_string(ruby.get(), code);
         auto* ctx = mrbc_context_new(ruby.get());
         ctx->capture_errors = true;
         // Set filename and line for debug messages
@@ -347,27 +1274,24 @@ struct mruby
         }
         ctx->lineno = 1;
 
+        TraceSpan span("exec", "script", file_name);
         // Parse and run the code in one go
-        mrb_load_string_cxt(ruby.get(), code.c_str(), ctx);
+        auto res = mrb_load_string_cxt(ruby.get(), code.c_str(), ctx);
+        mrbc_context_free(ruby.get(), ctx);
         if (ruby->exc != nullptr) {
-            auto obj = mrb_funcall(ruby.get(), mrb_obj_value(ruby->exc),
-                                   "inspect", 0);
-            auto err = value_to<std::string>(obj) + "\n";
-
-            auto bt = mrb_funcall(ruby.get(), mrb_obj_value(ruby->exc), "backtrace", 0);
-            if (!mrb_nil_p(bt)) {
-                auto backtrace = value_to<std::vector<std::string>>(bt);
-                ruby->exc = nullptr;
-                for (auto&& line : backtrace) {
-                    err += line;
-                    err += "\n";
-                }
-            }
-            throw mrb_exception(err);
-            //ErrorState::stack.push_back({ErrorType::Exception, backtrace, err});
-            //fmt::print("Error: {}\n", err);
+            return Error::take(ruby.get());
         }
+        return res;
+    }
 
+    //! Run `code`, throwing mrb_exception with the message and backtrace if
+    //! it raised
+    void exec(std::string const& code, const char* file_name = nullptr) const
+    {
+        auto res = try_exec(code, file_name);
+        if (!res) {
+            throw mrb_exception(res.error().what());
+        }
     }
 };
 
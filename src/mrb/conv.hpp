@@ -1,6 +1,9 @@
 #pragma once
 
 #include "base.hpp"
+#include "enums.hpp"
+#include "fields.hpp"
+#include "types.hpp"
 
 extern "C"
 {
@@ -10,12 +13,18 @@ extern "C"
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <typeinfo>
 #include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
 namespace mrb {
@@ -48,16 +57,82 @@ template <typename A, typename B>
 struct is_map<std::unordered_map<A, B>> : std::true_type
 {};
 
-struct ClassData
+//! Wraps a pointer to an object that ruby may use but must never free.
+//! Return `mrb::borrow(ptr)` from a bound function to hand out an object that
+//! is owned by the native side. Ruby can call mutating methods on it, so
+//! const objects can not be borrowed.
+template <typename T>
+struct Borrowed
 {
-   RClass* rclass;
-   mrb_data_type data_type;
+    static_assert(!std::is_const_v<T>, "const objects can not be borrowed");
+    T* ptr;
 };
-template <typename CLASS>
-struct Lookup
+
+template <typename T>
+Borrowed<T> borrow(T* ptr)
 {
-    static inline std::unordered_map<mrb_state*, ClassData> rclasses;
-};
+    static_assert(!std::is_const_v<T>, "const objects can not be borrowed");
+    return Borrowed<T>{ptr};
+}
+
+template <typename Type>
+struct is_borrowed : std::false_type
+{};
+
+template <typename T>
+struct is_borrowed<Borrowed<T>> : std::true_type
+{};
+
+template <typename Type>
+struct is_unique_ptr : std::false_type
+{};
+
+template <typename T, typename D>
+struct is_unique_ptr<std::unique_ptr<T, D>> : std::true_type
+{};
+
+template <typename Type>
+struct is_shared_ptr : std::false_type
+{};
+
+template <typename T>
+struct is_shared_ptr<std::shared_ptr<T>> : std::true_type
+{};
+
+template <typename Type>
+struct is_optional : std::false_type
+{};
+
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type
+{};
+
+template <typename Type>
+struct is_variant : std::false_type
+{};
+
+template <typename... T>
+struct is_variant<std::variant<T...>> : std::true_type
+{};
+
+// Tuples and pairs convert to fixed size arrays
+template <typename Type>
+struct is_tuple : std::false_type
+{};
+
+template <typename... T>
+struct is_tuple<std::tuple<T...>> : std::true_type
+{};
+
+template <typename A, typename B>
+struct is_tuple<std::pair<A, B>> : std::true_type
+{};
+
+template <typename T>
+T* data_ptr(mrb_value obj, mrb_state* mrb);
+
+template <typename T>
+std::shared_ptr<T> shared_data_ptr(mrb_value obj, mrb_state* mrb);
 
 struct Symbol
 {
@@ -71,6 +146,21 @@ struct Symbol
     operator uint32_t() { return sym; } // NOLINT
 };
 
+template <typename T>
+mrb_value fields_to_value(T const& r, mrb_state* mrb);
+
+template <typename T>
+T fields_from_value(mrb_value obj, mrb_state* mrb);
+
+template <typename T>
+T variant_from_value(mrb_value obj, mrb_state* mrb);
+
+template <typename T>
+T tuple_from_value(mrb_value obj, mrb_state* mrb);
+
+template <typename T>
+mrb_value tuple_to_value(T const& r, mrb_state* mrb);
+
 //! Convert ruby (mrb_value) type to native
 template <typename TARGET>
 TARGET value_to(mrb_value obj, mrb_state* mrb = nullptr)
@@ -90,24 +180,44 @@ TARGET value_to(mrb_value obj, mrb_state* mrb = nullptr)
             }
         }
         return result;
-    } else if constexpr (std::is_pointer_v<TARGET>) {
-        auto* res = DATA_PTR(obj);
-        if (res == nullptr) {
-            throw mrb_exception("nullptr");
+    } else if constexpr (is_optional<TARGET>()) {
+        if (mrb_nil_p(obj) || mrb_undef_p(obj)) {
+            return TARGET{};
+        }
+        return TARGET{value_to<typename TARGET::value_type>(obj, mrb)};
+    } else if constexpr (is_variant<TARGET>()) {
+        return variant_from_value<TARGET>(obj, mrb);
+    } else if constexpr (is_tuple<TARGET>()) {
+        return tuple_from_value<TARGET>(obj, mrb);
+    } else if constexpr (std::is_same_v<TARGET, std::monostate>) {
+        return TARGET{};
+    } else if constexpr (is_shared_ptr<TARGET>()) {
+        return shared_data_ptr<typename TARGET::element_type>(obj, mrb);
+    } else if constexpr (std::is_same_v<TARGET, const char*>) {
+        // Points into the ruby string, so only valid while it is alive
+        if (mrb_string_p(obj)) {
+            return mrb == nullptr ? RSTRING_PTR(obj) : mrb_string_cstr(mrb, obj);
+        }
+        if (mrb_symbol_p(obj) && mrb != nullptr) {
+            return mrb_sym_name(mrb, mrb_symbol(obj));
         }
-        return static_cast<TARGET>(res);
+        throw std::exception();
+    } else if constexpr (std::is_pointer_v<TARGET>) {
+        return data_ptr<std::remove_cv_t<std::remove_pointer_t<TARGET>>>(obj,
+                                                                       mrb);
 
     } else if constexpr (is_std_vector<TARGET>()) {
         TARGET result;
         using VAL = typename TARGET::value_type;
         if (!mrb_array_p(obj)) {
-            obj = mrb_funcall(mrb, obj, "to_a", 0);
+            obj = mrb_funcall_argv(mrb, obj, sym<names::to_a>(mrb), 0, nullptr);
         }
         if (mrb_array_p(obj)) {
             int sz = ARY_LEN(mrb_ary_ptr(obj)); // NOLINT
+            result.reserve(sz);
             for (int i = 0; i < sz; i++) {
                 auto v = mrb_ary_entry(obj, i);
-                result.push_back(value_to<VAL>(v));
+                result.push_back(value_to<VAL>(v, mrb));
             }
         } else {
             mrb_raise(mrb, E_TYPE_ERROR, "not an array");
@@ -117,13 +227,13 @@ TARGET value_to(mrb_value obj, mrb_state* mrb = nullptr)
         TARGET result;
         using VAL = typename TARGET::value_type;
         if (!mrb_array_p(obj)) {
-            obj = mrb_funcall(mrb, obj, "to_a", 0);
+            obj = mrb_funcall_argv(mrb, obj, sym<names::to_a>(mrb), 0, nullptr);
         }
         if (mrb_array_p(obj)) {
             int sz = ARY_LEN(mrb_ary_ptr(obj)); // NOLINT
             for (int i = 0; i < static_cast<int>(result.size()); i++) {
                 auto v = mrb_ary_entry(obj, i);
-                result[i] = i < sz ? value_to<VAL>(v) : VAL{};
+                result[i] = i < sz ? value_to<VAL>(v, mrb) : VAL{};
             }
         } else {
             mrb_raise(mrb, E_TYPE_ERROR, "not an array");
@@ -152,15 +262,29 @@ TARGET value_to(mrb_value obj, mrb_state* mrb = nullptr)
         return mrb_bool(obj);
     } else if constexpr (std::is_arithmetic_v<TARGET>) {
         if (mrb_float_p(obj)) {
+            // Integers that do not fit in mrb_int arrive as floats
+            if constexpr (std::is_integral_v<TARGET>) {
+                if (!float_fits<TARGET>(mrb_float(obj))) {
+                    if (mrb == nullptr) { throw std::exception(); }
+                    mrb_raise(mrb, E_RANGE_ERROR, "float out of integer range");
+                }
+            }
             return static_cast<TARGET>(mrb_float(obj));
         }
-        if (mrb_fixnum_p(obj)) {
-            return static_cast<TARGET>(mrb_fixnum(obj));
+        if (mrb_integer_p(obj)) {
+            return static_cast<TARGET>(mrb_integer(obj));
         }
         if (mrb_symbol_p(obj)) {
             return static_cast<TARGET>(mrb_symbol(obj));
         }
         throw std::exception();
+    } else if constexpr (has_enum_names<TARGET>()) {
+        return enum_from_value<TARGET>(obj, mrb);
+    } else if constexpr (std::is_enum_v<TARGET>) {
+        return static_cast<TARGET>(
+            value_to<std::underlying_type_t<TARGET>>(obj, mrb));
+    } else if constexpr (has_fields<TARGET>()) {
+        return fields_from_value<TARGET>(obj, mrb);
     } else {
         return static_cast<TARGET>(obj);
         //    throw std::exception();
@@ -179,24 +303,158 @@ inline mrb_value to_value(const char* r, mrb_state* mrb)
     return mrb_str_new_cstr(mrb, r);
 }
 
+// Check that `obj` is an object of T, or of a type declared as derived from
+// T, and return its data type
+template <typename T>
+DataType const* check_data(mrb_value obj, mrb_state* mrb)
+{
+    auto const* dt = data_type_of(obj);
+    auto const& target = type_info<T>();
+    if (dt == nullptr || !dt->info->ancestors.test(target.tag)) {
+        auto const* expected = data_type<T>()->struct_name;
+        if (mrb == nullptr) {
+            throw mrb_exception(std::string("wrong argument type (expected ") +
+                                expected + ")");
+        }
+        mrb_raisef(mrb, E_TYPE_ERROR, "wrong argument type %s (expected %s)",
+                   mrb_obj_classname(mrb, obj), expected);
+    }
+    return dt;
+}
+
+//! Get the native object from a ruby object of a class registered with
+//! make_class(). Raises a TypeError if `obj` is of another class.
+template <typename T>
+T* data_ptr(mrb_value obj, mrb_state* mrb)
+{
+    check_data<T>(obj, mrb);
+    auto* res = native_ptr<T>(obj);
+    if (res == nullptr) {
+        throw mrb_exception("nullptr");
+    }
+    return res;
+}
+
+//! Get a shared_ptr to the native object of a ruby object. Objects that are
+//! owned by ruby are converted to shared objects the first time, so ruby
+//! and native code share ownership from then on. Borrowed objects can not
+//! be shared. A converted object is freed with the deleter of its type,
+//! which may then run after the state is closed and is given a null state;
+//! see set_deleter().
+template <typename T>
+std::shared_ptr<T> shared_data_ptr(mrb_value obj, mrb_state* mrb)
+{
+    auto const* dt = check_data<T>(obj, mrb);
+    if (dt->holder == Holder::Borrowed) {
+        mrb_raise(mrb, E_TYPE_ERROR, "borrowed object can not be shared");
+    }
+    if (dt->holder == Holder::Owned) {
+        auto* dfree = dt->type.dfree;
+        DATA_PTR(obj) = new std::shared_ptr<void>(
+            DATA_PTR(obj), [dfree](void* p) { dfree(nullptr, p); });
+        DATA_TYPE(obj) =
+            &detail::data_types[dt->info->tag][static_cast<int>(Holder::Shared)]
+                 .type;
+    }
+    auto const& shared = *static_cast<std::shared_ptr<void>*>(DATA_PTR(obj));
+    return std::shared_ptr<T>(shared, native_ptr<T>(obj));
+}
+
+// Create a ruby object for a registered class. `data` is a T* or, for
+// Holder::Shared, a std::shared_ptr<void>* pointing to a T.
+template <typename T>
+mrb_value wrap_data(mrb_state* mrb, void* data, Holder holder)
+{
+    auto* rclass = Lookup<T>::rclasses[mrb].rclass;
+    if (rclass == nullptr) {
+        throw mrb_exception("Converting object of unregistered class");
+    }
+    auto* o = mrb_obj_alloc(mrb, MRB_TT_DATA, rclass);
+    auto obj = mrb_obj_value(o);
+    DATA_PTR(obj) = data;
+    DATA_TYPE(obj) = data_type<T>(holder);
+    return obj;
+}
+
+template <typename T>
+mrb_value wrap_data(mrb_state* mrb, T* ptr, Holder holder)
+{
+    using CLASS = std::remove_cv_t<T>;
+    return wrap_data<CLASS>(mrb, const_cast<CLASS*>(ptr), holder); // NOLINT
+}
+
+// Raw pointers passed to ruby are owned by ruby, and will be deleted when
+// the object is garbage collected. Null pointers become nil.
 template <typename RET,
           std::enable_if_t<std::is_pointer<std::remove_reference_t<RET>>::value,
                            bool> = true>
 mrb_value to_value(RET&& r, mrb_state* const mrb)
 {
-    // if constexpr (std::is_rvalue_reference_v<decltype(r)>) {
-    using T = typename std::remove_pointer_t<std::remove_reference_t<RET>>;
-    auto& cdata = Lookup<T>::rclasses[mrb];
-    auto* o = mrb_obj_alloc(mrb, MRB_TT_DATA, cdata.rclass);
-    auto obj = mrb_obj_value(o);
-    DATA_PTR(obj) = r;
-    DATA_TYPE(obj) = &cdata.data_type;
+    if (r == nullptr) { return mrb_nil_value(); }
+    return wrap_data(mrb, r, Holder::Owned);
+}
+
+template <typename T>
+mrb_value to_value(std::unique_ptr<T>&& r, mrb_state* const mrb)
+{
+    if (!r) { return mrb_nil_value(); }
+    auto obj = wrap_data(mrb, r.get(), Holder::Owned);
+    r.release();
+    return obj;
+}
+
+template <typename T>
+mrb_value to_value(Borrowed<T> const& r, mrb_state* const mrb)
+{
+    if (r.ptr == nullptr) { return mrb_nil_value(); }
+    return wrap_data(mrb, r.ptr, Holder::Borrowed);
+}
+
+//! Shared objects are not copied; the ruby object holds a reference that
+//! is released when it is garbage collected. Null pointers become nil.
+template <typename T>
+mrb_value to_value(std::shared_ptr<T> const& r, mrb_state* const mrb)
+{
+    if (!r) { return mrb_nil_value(); }
+    using CLASS = std::remove_cv_t<T>;
+    auto holder = std::make_unique<std::shared_ptr<void>>(
+        std::const_pointer_cast<CLASS>(r));
+    auto obj = wrap_data<CLASS>(mrb, holder.get(), Holder::Shared);
+    holder.release();
     return obj;
-    //} else {
-    //    return RET::pointers_must_be_moved;
-    //}
 }
 
+// True for class types that are not converted by value, and so are
+// expected to be registered with make_class()
+template <typename T>
+constexpr bool is_bound_class()
+{
+    return std::is_class_v<T> && !std::is_convertible_v<T, mrb_value> &&
+           !std::is_same_v<T, std::string> && !std::is_same_v<T, Symbol> &&
+           !is_map<T>() && !is_std_vector<T>() && !is_std_array<T>() &&
+           !has_fields<T>() && !is_borrowed<T>() && !is_unique_ptr<T>() &&
+           !is_shared_ptr<T>() && !is_optional<T>() && !is_variant<T>() &&
+           !is_tuple<T>() && !std::is_same_v<T, std::monostate>;
+}
+
+//! Objects of registered classes returned by value are moved into a new
+//! ruby owned object
+template <typename SOURCE,
+          std::enable_if_t<!std::is_reference_v<SOURCE> &&
+                               is_bound_class<std::remove_cv_t<SOURCE>>(),
+                           bool> = true>
+mrb_value to_value(SOURCE&& r, mrb_state* const mrb)
+{
+    using T = std::remove_cv_t<SOURCE>;
+    return to_value(std::make_unique<T>(std::move(r)), mrb);
+}
+
+template <typename ELEM>
+mrb_value to_value(std::vector<ELEM> const& r, mrb_state* mrb);
+
+template <typename ELEM, size_t N>
+mrb_value to_value(std::array<ELEM, N> const& r, mrb_state* mrb);
+
 template <typename SOURCE,
           std::enable_if_t<!std::is_pointer_v<std::remove_reference_t<SOURCE>>,
                            bool> = true>
@@ -205,8 +463,10 @@ mrb_value to_value(SOURCE const& r, mrb_state* const mrb)
     // fmt::print("toval {}\n", typeid(RET).name());
     if constexpr (is_map<SOURCE>()) {
         auto hash = mrb_hash_new(mrb);
-        for (auto [key, val] : r) {
+        auto arena = mrb_gc_arena_save(mrb);
+        for (auto const& [key, val] : r) {
             mrb_hash_set(mrb, hash, to_value(key, mrb), to_value(val, mrb));
+            mrb_gc_arena_restore(mrb, arena);
         }
         return hash;
 
@@ -217,9 +477,12 @@ mrb_value to_value(SOURCE const& r, mrb_state* const mrb)
     } else if constexpr (std::is_floating_point_v<SOURCE>) {
         return mrb_float_value(mrb, r);
     } else if constexpr (std::is_integral_v<SOURCE>) {
-        return mrb_int_value(mrb, r);
+        return integer_value(r, mrb);
+    } else if constexpr (has_enum_names<SOURCE>()) {
+        return enum_to_value(r, mrb);
     } else if constexpr (std::is_enum_v<SOURCE>) {
-        return mrb_int_value(mrb, r);
+        return integer_value(static_cast<std::underlying_type_t<SOURCE>>(r),
+                             mrb);
     } else if constexpr (std::is_same_v<std::remove_reference_t<SOURCE>,
                                         std::string>) {
         return mrb_str_new_cstr(mrb, r.c_str());
@@ -231,29 +494,55 @@ mrb_value to_value(SOURCE const& r, mrb_state* const mrb)
         // fmt::print("Returning {}\n", r.sym);
         return mrb_symbol_value(r.sym);
         // return mrb_check_intern_cstr(mrb, r.sym.c_str());
+    } else if constexpr (has_fields<SOURCE>()) {
+        return fields_to_value(r, mrb);
+    } else if constexpr (is_optional<SOURCE>()) {
+        return r ? to_value(*r, mrb) : mrb_nil_value();
+    } else if constexpr (is_variant<SOURCE>()) {
+        return std::visit([mrb](auto const& v) { return to_value(v, mrb); },
+                          r);
+    } else if constexpr (is_tuple<SOURCE>()) {
+        return tuple_to_value(r, mrb);
+    } else if constexpr (std::is_same_v<SOURCE, std::monostate>) {
+        return mrb_nil_value();
+    } else if constexpr (is_unique_ptr<SOURCE>()) {
+        static_assert(!is_unique_ptr<SOURCE>(),
+                      "std::unique_ptr must be moved to ruby, and custom "
+                      "deleters are not supported");
+        return mrb_nil_value();
+    } else if constexpr (is_bound_class<SOURCE>()) {
+        return to_value(std::make_unique<SOURCE>(r), mrb);
     } else {
         return SOURCE::can_not_convert;
     }
 }
 
+// Convert a range of native values into a new ruby array. The array is
+// allocated with its final capacity, and the GC arena is restored after each
+// element so converting large containers does not grow the arena.
+template <typename IT>
+mrb_value to_array_value(IT first, IT last, size_t size, mrb_state* mrb)
+{
+    auto ary = mrb_ary_new_capa(mrb, static_cast<mrb_int>(size));
+    auto arena = mrb_gc_arena_save(mrb);
+    for (; first != last; ++first) {
+        typename std::iterator_traits<IT>::value_type const& elem = *first;
+        mrb_ary_push(mrb, ary, to_value(elem, mrb));
+        mrb_gc_arena_restore(mrb, arena);
+    }
+    return ary;
+}
+
 template <typename ELEM>
 mrb_value to_value(std::vector<ELEM> const& r, mrb_state* mrb)
 {
-    std::vector<mrb_value> output(r.size());
-    std::transform(r.begin(), r.end(), output.begin(),
-                   [&](ELEM const& e) { return to_value(e, mrb); });
-    return mrb_ary_new_from_values(mrb, static_cast<mrb_int>(output.size()),
-                                   output.data());
+    return to_array_value(r.begin(), r.end(), r.size(), mrb);
 }
 
 template <typename ELEM, size_t N>
 mrb_value to_value(std::array<ELEM, N> const& r, mrb_state* mrb)
 {
-    std::vector<mrb_value> output(r.size());
-    std::transform(r.begin(), r.end(), output.begin(),
-                   [&](ELEM const& e) { return to_value(e, mrb); });
-    return mrb_ary_new_from_values(mrb, static_cast<mrb_int>(output.size()),
-                                   output.data());
+    return to_array_value(r.begin(), r.end(), N, mrb);
 }
 
 template <typename T, size_t N>
@@ -261,7 +550,7 @@ std::array<T, N> to_array(mrb_value ary, mrb_state* mrb)
 {
     std::array<T, N> result{};
     if (!mrb_array_p(ary)) {
-        ary = mrb_funcall(mrb, ary, "to_a", 0);
+        ary = mrb_funcall_argv(mrb, ary, sym<names::to_a>(mrb), 0, nullptr);
     }
     if (mrb_array_p(ary)) {
         auto sz = ARY_LEN(mrb_ary_ptr(ary));
@@ -271,7 +560,7 @@ std::array<T, N> to_array(mrb_value ary, mrb_state* mrb)
         }
         for (int i = 0; i < sz; i++) {
             auto v = mrb_ary_entry(ary, i);
-            result[i] = value_to<T>(v);
+            result[i] = value_to<T>(v, mrb);
         }
     } else {
         mrb_raise(mrb, E_TYPE_ERROR, "not an array");
@@ -279,10 +568,233 @@ std::array<T, N> to_array(mrb_value ary, mrb_state* mrb)
     return result;
 }
 
+//! Convert a struct with a field table (see fields.hpp) to a ruby Hash or
+//! Struct, depending on its layout
+template <typename T>
+mrb_value fields_to_value(T const& r, mrb_state* mrb)
+{
+    auto& table = FieldTable<T>::get(mrb);
+    constexpr auto N = field_count<T>();
+    if constexpr (layout_of<T>() == Layout::Struct) {
+        if (table.struct_class == nullptr) {
+            std::array<mrb_value, N> members{};
+            for (size_t i = 0; i < N; i++) {
+                members[i] = mrb_symbol_value(table.syms[i]);
+            }
+            auto cls = mrb_funcall_argv(
+                mrb, mrb_obj_value(mrb_class_get(mrb, "Struct")),
+                sym<names::new_>(mrb), N, members.data());
+            mrb_gc_register(mrb, cls);
+            table.struct_class = mrb_class_ptr(cls);
+        }
+        auto arena = mrb_gc_arena_save(mrb);
+        std::array<mrb_value, N> values{};
+        std::apply(
+            [&](auto const&... f) {
+                size_t i = 0;
+                ((values[i++] = to_value(r.*(f.ptr), mrb)), ...);
+            },
+            Fields<T>::value);
+        auto obj = mrb_obj_new(mrb, table.struct_class, N, values.data());
+        mrb_gc_arena_restore(mrb, arena);
+        mrb_gc_protect(mrb, obj);
+        return obj;
+    } else {
+        auto hash = mrb_hash_new_capa(mrb, N);
+        auto arena = mrb_gc_arena_save(mrb);
+        std::apply(
+            [&](auto const&... f) {
+                size_t i = 0;
+                ((mrb_hash_set(mrb, hash, mrb_symbol_value(table.syms[i++]),
+                               to_value(r.*(f.ptr), mrb)),
+                  mrb_gc_arena_restore(mrb, arena)),
+                 ...);
+            },
+            Fields<T>::value);
+        return hash;
+    }
+}
+
+template <typename M>
+void copy_field(M& target, mrb_value v, mrb_state* mrb)
+{
+    if (!mrb_undef_p(v)) {
+        target = value_to<M>(v, mrb);
+    }
+}
+
+//! Convert a ruby Hash with symbol keys, or a Struct created by
+//! fields_to_value(), to a native struct. Missing keys keep the value the
+//! field was default initialized with.
+template <typename T>
+T fields_from_value(mrb_value obj, mrb_state* mrb)
+{
+    auto& table = FieldTable<T>::get(mrb);
+    T result{};
+    if (mrb_hash_p(obj)) {
+        std::apply(
+            [&](auto const&... f) {
+                size_t i = 0;
+                ((copy_field(result.*(f.ptr),
+                             mrb_hash_fetch(mrb, obj,
+                                            mrb_symbol_value(table.syms[i++]),
+                                            mrb_undef_value()),
+                             mrb)),
+                 ...);
+            },
+            Fields<T>::value);
+    } else if (table.struct_class != nullptr &&
+               mrb_obj_class(mrb, obj) == table.struct_class) {
+        // Struct instances share the memory layout of arrays, so the values
+        // can be read directly in field order
+        auto* values = RARRAY_PTR(obj);
+        std::apply(
+            [&](auto const&... f) {
+                size_t i = 0;
+                ((copy_field(result.*(f.ptr), values[i++], mrb)), ...);
+            },
+            Fields<T>::value);
+    } else {
+        mrb_raise(mrb, E_TYPE_ERROR, "expected a Hash or Struct");
+    }
+    return result;
+}
+
+template <typename T>
+mrb_value tuple_to_value(T const& r, mrb_state* mrb)
+{
+    auto ary = mrb_ary_new_capa(mrb, std::tuple_size_v<T>);
+    auto arena = mrb_gc_arena_save(mrb);
+    std::apply(
+        [&](auto const&... e) {
+            ((mrb_ary_push(mrb, ary, to_value(e, mrb)),
+              mrb_gc_arena_restore(mrb, arena)),
+             ...);
+        },
+        r);
+    return ary;
+}
+
+template <typename T, size_t... I>
+T tuple_from_array(mrb_value ary, mrb_state* mrb, std::index_sequence<I...>)
+{
+    return T{value_to<std::tuple_element_t<I, T>>(mrb_ary_entry(ary, I),
+                                                  mrb)...};
+}
+
+//! Convert a ruby array to a std::tuple or std::pair. The array must have
+//! exactly as many elements as the tuple.
+template <typename T>
+T tuple_from_value(mrb_value obj, mrb_state* mrb)
+{
+    constexpr auto N = std::tuple_size_v<T>;
+    if (!mrb_array_p(obj) || ARY_LEN(mrb_ary_ptr(obj)) != N) {
+        if (mrb == nullptr) {
+            throw mrb_exception("not an array of the right size");
+        }
+        mrb_raisef(mrb, E_TYPE_ERROR, "expected an array of %i elements",
+                   static_cast<mrb_int>(N));
+    }
+    return tuple_from_array<T>(obj, mrb, std::make_index_sequence<N>());
+}
+
+//! Check if `obj` has the ruby type that the native type T converts from.
+//! When `exact` is false, integers are also accepted as floats and symbols
+//! as strings.
+template <typename T>
+bool value_is(mrb_value obj, bool exact)
+{
+    if constexpr (std::is_same_v<T, mrb_value>) {
+        return true;
+    } else if constexpr (std::is_same_v<T, std::monostate>) {
+        return mrb_nil_p(obj);
+    } else if constexpr (is_optional<T>()) {
+        return mrb_nil_p(obj) ||
+               value_is<typename T::value_type>(obj, exact);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return mrb_true_p(obj) || mrb_false_p(obj);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return mrb_float_p(obj) || (!exact && mrb_integer_p(obj));
+    } else if constexpr (std::is_integral_v<T>) {
+        // Also a whole float, if T holds integers that mrb_int can not
+        if constexpr (!fits_mrb_int<T>()) {
+            if (mrb_float_p(obj)) {
+                auto f = mrb_float(obj);
+                return float_fits<T>(f) && f == std::trunc(f);
+            }
+        }
+        return mrb_integer_p(obj);
+    } else if constexpr (has_enum_names<T>()) {
+        return mrb_symbol_p(obj);
+    } else if constexpr (std::is_enum_v<T>) {
+        return mrb_integer_p(obj);
+    } else if constexpr (std::is_same_v<T, Symbol>) {
+        return mrb_symbol_p(obj);
+    } else if constexpr (std::is_same_v<T, std::string> ||
+                         std::is_same_v<T, std::string_view> ||
+                         std::is_same_v<T, const char*>) {
+        return mrb_string_p(obj) || (!exact && mrb_symbol_p(obj));
+    } else if constexpr (is_std_vector<T>() || is_std_array<T>() ||
+                         is_tuple<T>()) {
+        return mrb_array_p(obj);
+    } else if constexpr (is_map<T>()) {
+        return mrb_hash_p(obj);
+    } else if constexpr (has_fields<T>()) {
+        return mrb_hash_p(obj) || mrb_type(obj) == MRB_TT_STRUCT;
+    } else if constexpr (is_shared_ptr<T>() || std::is_pointer_v<T>) {
+        using E = std::remove_cv_t<typename std::pointer_traits<T>::element_type>;
+        return value_is<E>(obj, exact);
+    } else if constexpr (is_bound_class<T>()) {
+        auto const* dt = data_type_of(obj);
+        return dt != nullptr && dt->info->ancestors.test(type_info<T>().tag);
+    } else {
+        return T::can_not_convert;
+    }
+}
+
+//! Convert to the first alternative of the variant that has the ruby type of
+//! `obj`, or failing that the first one `obj` can be converted to. The
+//! conversions are a table indexed by alternative, so nothing is tried and
+//! thrown away. Raises TypeError if no alternative matches.
+template <typename V, size_t... I>
+V variant_from_value(mrb_value obj, mrb_state* mrb, std::index_sequence<I...>)
+{
+    constexpr auto N = sizeof...(I);
+    using Convert = V (*)(mrb_value, mrb_state*);
+    static constexpr std::array<Convert, N> convert{
+        [](mrb_value o, mrb_state* m) -> V {
+            return V{std::in_place_index<I>,
+                     value_to<std::variant_alternative_t<I, V>>(o, m)};
+        }...};
+    size_t index = N;
+    ((index == N && value_is<std::variant_alternative_t<I, V>>(obj, true) &&
+      (index = I, true)),
+     ...);
+    ((index == N && value_is<std::variant_alternative_t<I, V>>(obj, false) &&
+      (index = I, true)),
+     ...);
+    if (index == N) {
+        if (mrb == nullptr) {
+            throw mrb_exception("no matching variant type");
+        }
+        mrb_raisef(mrb, E_TYPE_ERROR, "unexpected argument type %s",
+                   mrb_obj_classname(mrb, obj));
+    }
+    return convert[index](obj, mrb);
+}
+
+template <typename T>
+T variant_from_value(mrb_value obj, mrb_state* mrb)
+{
+    return variant_from_value<T>(
+        obj, mrb, std::make_index_sequence<std::variant_size_v<T>>());
+}
+
 inline std::optional<std::string> check_exception(mrb_state* ruby)
 {
     if (ruby->exc != nullptr) {
-        auto obj = mrb_funcall(ruby, mrb_obj_value(ruby->exc), "inspect", 0);
+        auto obj = mrb_funcall_argv(ruby, mrb_obj_value(ruby->exc),
+                                    sym<names::inspect>(ruby), 0, nullptr);
         return value_to<std::string>(obj);
     }
     return std::nullopt;
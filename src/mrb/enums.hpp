@@ -0,0 +1,214 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace mrb {
+
+//! One entry in an enum table; the ruby name of an enumerator and its value
+template <typename E>
+struct Enumerator
+{
+    const char* name;
+    E value;
+};
+
+template <typename E>
+constexpr Enumerator<E> enumerator(const char* name, E value)
+{
+    return {name, value};
+}
+
+// Enums<E> is the name table for the enum E. Enums with a table are converted
+// to and from ruby symbols instead of integers. Specialize it with a static
+// `value` holding the table, ie
+//
+//   template <>
+//   struct mrb::Enums<Color> {
+//       static constexpr std::array value{mrb::enumerator("red", Color::Red),
+//                                         mrb::enumerator("green", Color::Green)};
+//   };
+template <typename E, typename = void>
+struct Enums
+{};
+
+template <typename E, typename = void>
+struct has_enum_names : std::false_type
+{};
+
+template <typename E>
+struct has_enum_names<E, std::void_t<decltype(Enums<E>::value)>>
+    : std::true_type
+{};
+
+namespace detail {
+
+// Maps enum values to their position in the name table. When the values are
+// reasonably dense, which they almost always are, this is a constexpr array
+// indexed by value, otherwise the (short) table is searched.
+template <typename E>
+struct EnumIndex
+{
+    static constexpr auto const& values = Enums<E>::value;
+    static constexpr size_t count = values.size();
+
+    static constexpr long long as_int(E e) { return static_cast<long long>(e); }
+
+    static constexpr long long lowest()
+    {
+        long long low = as_int(values[0].value);
+        for (auto const& e : values) {
+            low = as_int(e.value) < low ? as_int(e.value) : low;
+        }
+        return low;
+    }
+
+    static constexpr long long highest()
+    {
+        long long high = as_int(values[0].value);
+        for (auto const& e : values) {
+            high = as_int(e.value) > high ? as_int(e.value) : high;
+        }
+        return high;
+    }
+
+    static constexpr long long low = lowest();
+    static constexpr size_t span = static_cast<size_t>(highest() - low) + 1;
+    static constexpr bool dense = span <= count * 4 + 16;
+
+    static constexpr auto make_table()
+    {
+        std::array<int, dense ? span : 0> table{};
+        for (auto& i : table) {
+            i = -1;
+        }
+        if constexpr (dense) {
+            for (size_t i = 0; i < count; i++) {
+                auto& slot = table[static_cast<size_t>(as_int(values[i].value) - low)];
+                // The first name of an aliased value is the one ruby sees
+                slot = slot < 0 ? static_cast<int>(i) : slot;
+            }
+        }
+        return table;
+    }
+
+    static constexpr auto table = make_table();
+
+    //! Position of `e` in the name table, or -1 if it has no name
+    static constexpr int index_of(E e)
+    {
+        if constexpr (dense) {
+            auto i = as_int(e) - low;
+            return i >= 0 && i < static_cast<long long>(span)
+                       ? table[static_cast<size_t>(i)]
+                       : -1;
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                if (values[i].value == e) {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        }
+    }
+};
+
+} // namespace detail
+
+// The per state data for an enum with a name table; its names interned as
+// symbols, and a table from symbol back to position in the name table.
+// Symbols interned together are usually consecutive, so the reverse table is
+// indexed by symbol.
+template <typename E>
+struct EnumTable
+{
+    using Index = detail::EnumIndex<E>;
+
+    std::array<mrb_sym, Index::count> syms{};
+    mrb_sym first_sym = 0;
+    std::vector<int> by_sym;
+
+    static EnumTable& get(mrb_state* mrb)
+    {
+        return detail::StateMap<EnumTable>::get(mrb, [mrb] {
+            EnumTable table;
+            for (size_t i = 0; i < Index::count; i++) {
+                auto const* name = Index::values[i].name;
+                table.syms[i] = mrb_intern_static(mrb, name, std::strlen(name));
+            }
+            auto low = table.syms[0];
+            auto high = table.syms[0];
+            for (auto sym : table.syms) {
+                low = sym < low ? sym : low;
+                high = sym > high ? sym : high;
+            }
+            if (high - low < Index::count * 4 + 16) {
+                table.first_sym = low;
+                table.by_sym.assign(high - low + 1, -1);
+                for (size_t i = 0; i < Index::count; i++) {
+                    table.by_sym[table.syms[i] - low] = static_cast<int>(i);
+                }
+            }
+            return table;
+        });
+    }
+
+    //! Position of the enumerator named `sym`, or -1 if there is none
+    [[nodiscard]] int index_of(mrb_sym sym) const
+    {
+        if (!by_sym.empty()) {
+            return sym >= first_sym && sym - first_sym < by_sym.size()
+                       ? by_sym[sym - first_sym]
+                       : -1;
+        }
+        for (size_t i = 0; i < syms.size(); i++) {
+            if (syms[i] == sym) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+};
+
+//! Convert an enum with a name table to a symbol. Values without a name are
+//! converted to integers.
+template <typename E>
+mrb_value enum_to_value(E e, mrb_state* mrb)
+{
+    auto i = detail::EnumIndex<E>::index_of(e);
+    if (i < 0) {
+        return integer_value(static_cast<std::underlying_type_t<E>>(e), mrb);
+    }
+    return mrb_symbol_value(EnumTable<E>::get(mrb).syms[i]);
+}
+
+//! Convert a symbol, or an integer with the value of a named enumerator, to
+//! an enum with a name table. Raises ArgumentError for anything else.
+template <typename E>
+E enum_from_value(mrb_value obj, mrb_state* mrb)
+{
+    using Index = detail::EnumIndex<E>;
+    if (mrb_symbol_p(obj) && mrb != nullptr) {
+        auto i = EnumTable<E>::get(mrb).index_of(mrb_symbol(obj));
+        if (i >= 0) {
+            return Index::values[i].value;
+        }
+    } else if (mrb_integer_p(obj)) {
+        auto e = static_cast<E>(mrb_integer(obj));
+        if (Index::index_of(e) >= 0) {
+            return e;
+        }
+    }
+    if (mrb == nullptr) {
+        throw mrb_exception("invalid enum value");
+    }
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid enum value %!v", obj);
+    return E{};
+}
+
+} // namespace mrb
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+
+namespace mrb {
+
+//! One entry in a field table; the ruby name of a field and a pointer to it
+template <typename CLASS, typename M>
+struct Field
+{
+    using class_type = CLASS;
+    using member_type = M;
+    const char* name;
+    M CLASS::*ptr;
+    bool required;
+};
+
+template <typename CLASS, typename M>
+constexpr Field<CLASS, M> field(const char* name, M CLASS::*ptr)
+{
+    return {name, ptr, false};
+}
+
+//! A field that must be given when the struct is taken as keyword
+//! arguments (see mrb::Kwargs)
+template <typename CLASS, typename M>
+constexpr Field<CLASS, M> required_field(const char* name, M CLASS::*ptr)
+{
+    return {name, ptr, true};
+}
+
+//! How a struct with a field table is represented on the ruby side
+enum class Layout
+{
+    Hash,  //!< A Hash with symbol keys
+    Struct //!< An instance of a ruby Struct class created for the type
+};
+
+// Fields<T> is the field table for T. By default it is taken from a static
+// `fields()` function in T, ie
+//
+//   struct Config {
+//       int width;
+//       std::string title;
+//       static constexpr auto fields() {
+//           return std::tuple{mrb::field("width", &Config::width),
+//                             mrb::field("title", &Config::title)};
+//       }
+//   };
+//
+// For types you can not change, specialize Fields<T> instead and give it a
+// static `value` holding the table. Either form may also declare a static
+// `layout` to select Layout::Struct.
+template <typename T, typename = void>
+struct Fields
+{};
+
+namespace detail {
+template <typename T, typename = void>
+struct member_layout
+{
+    static constexpr Layout value = Layout::Hash;
+};
+
+template <typename T>
+struct member_layout<T, std::void_t<decltype(T::layout)>>
+{
+    static constexpr Layout value = T::layout;
+};
+} // namespace detail
+
+template <typename T>
+struct Fields<T, std::void_t<decltype(T::fields())>>
+{
+    static constexpr auto value = T::fields();
+    static constexpr Layout layout = detail::member_layout<T>::value;
+};
+
+template <typename T, typename = void>
+struct has_fields : std::false_type
+{};
+
+template <typename T>
+struct has_fields<T, std::void_t<decltype(Fields<T>::value)>> : std::true_type
+{};
+
+template <typename T>
+constexpr Layout layout_of()
+{
+    return detail::member_layout<Fields<T>>::value;
+}
+
+template <typename T>
+constexpr size_t field_count()
+{
+    return std::tuple_size_v<std::remove_const_t<decltype(Fields<T>::value)>>;
+}
+
+template <typename T>
+constexpr size_t required_count()
+{
+    return std::apply(
+        [](auto const&... f) { return (size_t{0} + ... + (f.required ? 1 : 0)); },
+        Fields<T>::value);
+}
+
+// The position of each field in the keyword table passed to mrb_get_args(),
+// which must list required keywords first. Fields otherwise keep their
+// order.
+template <typename T>
+constexpr std::array<size_t, field_count<T>()> keyword_positions()
+{
+    std::array<size_t, field_count<T>()> pos{};
+    size_t req = 0;
+    size_t opt = required_count<T>();
+    std::apply(
+        [&](auto const&... f) {
+            size_t i = 0;
+            ((pos[i++] = f.required ? req++ : opt++), ...);
+        },
+        Fields<T>::value);
+    return pos;
+}
+
+// The per state data for a type with a field table; its field names
+// interned as symbols, in field order and in keyword table order, and the
+// Struct class used for Layout::Struct
+template <typename T>
+struct FieldTable
+{
+    std::array<mrb_sym, field_count<T>()> syms{};
+    std::array<mrb_sym, field_count<T>()> kw_syms{};
+    RClass* struct_class = nullptr;
+
+    static FieldTable& get(mrb_state* mrb)
+    {
+        return detail::StateMap<FieldTable>::get(mrb, [mrb] {
+            FieldTable table;
+            std::apply(
+                [&](auto const&... f) {
+                    size_t i = 0;
+                    ((table.syms[i++] = mrb_intern_cstr(mrb, f.name)), ...);
+                },
+                Fields<T>::value);
+            constexpr auto pos = keyword_positions<T>();
+            for (size_t i = 0; i < pos.size(); i++) {
+                table.kw_syms[pos[i]] = table.syms[i];
+            }
+            return table;
+        });
+    }
+};
+
+} // namespace mrb
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "base.hpp"
+#include "result.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace mrb {
+
+enum class GcMode
+{
+    Incremental,
+    Generational
+};
+
+//! One run of the collector started through this API
+struct GcPause
+{
+    std::chrono::nanoseconds time{};
+    size_t freed = 0;       //!< Objects freed during the pause
+    bool full = false;      //!< A full collection, rather than steps
+    bool completed = false; //!< The collection cycle finished
+};
+
+//! Totals for the collections run through this API on one state. The
+//! incremental steps and collections mruby starts by itself when objects
+//! are allocated are not timed, and not counted here; the step ratio is
+//! what keeps those short.
+struct GcStats
+{
+    size_t pauses = 0;
+    size_t cycles = 0; //!< Completed collection cycles
+    size_t freed = 0;
+    std::chrono::nanoseconds total{};
+    std::chrono::nanoseconds longest{};
+    GcPause last{};
+};
+
+namespace detail {
+
+struct GcState
+{
+    GcStats stats;
+    std::function<void(GcPause const&)> on_pause;
+
+    static GcState& get(mrb_state* mrb)
+    {
+        return StateMap<GcState>::get(mrb, [] { return GcState{}; });
+    }
+};
+
+inline GcPause record_pause(mrb_state* mrb, GcPause const& pause)
+{
+    auto& gs = GcState::get(mrb);
+    auto& stats = gs.stats;
+    stats.pauses++;
+    stats.cycles += pause.completed ? 1 : 0;
+    stats.freed += pause.freed;
+    stats.total += pause.time;
+    stats.longest = pause.time > stats.longest ? pause.time : stats.longest;
+    stats.last = pause;
+    if (gs.on_pause) { gs.on_pause(pause); }
+    return pause;
+}
+
+} // namespace detail
+
+//! Switch between incremental and generational collection. Same as setting
+//! `GC.generational_mode` from ruby. Throws mrb_exception if ruby refuses,
+//! like while the collector is disabled.
+inline void gc_set_mode(mrb_state* mrb, GcMode mode)
+{
+    auto v = mrb_bool_value(mode == GcMode::Generational);
+    mrb_funcall_argv(mrb, mrb_obj_value(mrb_module_get(mrb, "GC")),
+                     sym<names::generational_mode_set>(mrb), 1, &v);
+    if (mrb->exc != nullptr) {
+        throw mrb_exception(Error::take(mrb).message());
+    }
+}
+
+inline GcMode gc_mode(mrb_state* mrb)
+{
+    return mrb->gc.generational ? GcMode::Generational : GcMode::Incremental;
+}
+
+//! How much the heap may grow after a collection before the next one
+//! starts, in percent of the live objects. Default 200.
+inline void gc_set_interval_ratio(mrb_state* mrb, int ratio)
+{
+    mrb->gc.interval_ratio = ratio;
+}
+
+//! How much work each incremental step does, in percent. Default 200.
+inline void gc_set_step_ratio(mrb_state* mrb, int ratio)
+{
+    mrb->gc.step_ratio = ratio;
+}
+
+//! Run incremental collection steps until the cycle completes or `budget`
+//! is spent. At least one step is run, so a step may go over the budget by
+//! the time of a single step; lower the step ratio to make steps shorter.
+//! Useful at points where a pause is acceptable, like the end of a frame.
+inline GcPause gc_step(mrb_state* mrb, std::chrono::nanoseconds budget)
+{
+    using Clock = std::chrono::steady_clock;
+    if (mrb->gc.disabled) { return {}; }
+    TraceSpan span("gc_step", "gc");
+    auto const live = mrb->gc.live;
+    auto const start = Clock::now();
+    auto elapsed = std::chrono::nanoseconds{};
+    do {
+        mrb_incremental_gc(mrb);
+        elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start);
+    } while (mrb->gc.state != MRB_GC_STATE_ROOT && elapsed < budget);
+
+    return detail::record_pause(
+        mrb, {elapsed, live > mrb->gc.live ? live - mrb->gc.live : 0, false,
+              mrb->gc.state == MRB_GC_STATE_ROOT});
+}
+
+//! Run a full collection, like `GC.start`. Does nothing while the
+//! collector is disabled.
+inline GcPause gc_full(mrb_state* mrb)
+{
+    using Clock = std::chrono::steady_clock;
+    if (mrb->gc.disabled) { return {}; }
+    TraceSpan span("gc_full", "gc");
+    auto const live = mrb->gc.live;
+    auto const start = Clock::now();
+    mrb_full_gc(mrb);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start);
+    return detail::record_pause(
+        mrb, {elapsed, live > mrb->gc.live ? live - mrb->gc.live : 0, true,
+              true});
+}
+
+inline GcStats gc_stats(mrb_state* mrb)
+{
+    return detail::GcState::get(mrb).stats;
+}
+
+//! Call `fn` after every pause run through this API. Not called for the
+//! collections mruby starts by itself.
+inline void gc_on_pause(mrb_state* mrb, std::function<void(GcPause const&)> fn)
+{
+    detail::GcState::get(mrb).on_pause = std::move(fn);
+}
+
+} // namespace mrb
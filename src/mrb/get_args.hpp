@@ -9,12 +9,55 @@
 #include <optional>
 #include <string>
 #include <tuple>
+#include <variant>
 #include <vector>
 
 namespace mrb {
 
 // get_spec() - generate a spec string for ruby get args
 
+//! Take a struct with a field table (see fields.hpp) as keyword arguments.
+//! Keywords that are not given keep the value the field was default
+//! initialized with, and fields declared with required_field() must be given.
+//!
+//! mrb::add_kernel_function(ruby, "open_window",
+//!     [](int id, mrb::Kwargs<WindowOptions> opts) { open(id, opts->width); });
+template <typename T>
+struct Kwargs
+{
+    using type = T;
+    T value{};
+
+    T* operator->() { return &value; }
+    T const* operator->() const { return &value; }
+    T& operator*() { return value; }
+    T const& operator*() const { return value; }
+};
+
+template <typename Type>
+struct is_kwargs : std::false_type
+{};
+
+template <typename T>
+struct is_kwargs<Kwargs<T>> : std::true_type
+{};
+
+// The keyword arguments as given by ruby for a Kwargs<T> parameter, in
+// keyword table order. Keywords that are not given are left undefined.
+template <typename T>
+struct KwargsArg
+{
+    std::array<mrb_value, field_count<T>()> values{};
+    mrb_kwargs kw{};
+};
+
+// The argument as given by ruby for a std::optional parameter. Left as nil
+// if the caller leaves it out.
+struct OptionalArg
+{
+    mrb_value val = mrb_nil_value();
+};
+
 
 template <typename ARG>
 size_t get_spec(mrb_state* mrb, std::vector<char>&, std::vector<void*>&, ARG*);
@@ -25,16 +68,6 @@ inline size_t get_spec(mrb_state*, std::vector<char>&, std::vector<void*>&,
     return 0;
 }
 
-template <typename OBJ>
-inline size_t get_spec(mrb_state* mrb, std::vector<char>& target,
-                       std::vector<void*>& ptrs, OBJ** p)
-{
-    ptrs.push_back(p);
-    ptrs.push_back(&Lookup<OBJ>::rclasses[mrb].data_type);
-    target.push_back('d');
-    return target.size();
-}
-
 inline size_t get_spec(mrb_state*, std::vector<char>& target,
                        std::vector<void*>& ptrs, mrb_sym* p)
 {
@@ -75,6 +108,36 @@ inline size_t get_spec(mrb_state*, std::vector<char>& target,
     return target.size();
 }
 
+// Optional arguments are only left out by ruby when they are trailing, so
+// everything from the first one on is marked optional with '|'
+inline size_t get_spec(mrb_state*, std::vector<char>& target,
+                       std::vector<void*>& ptrs, OptionalArg* p)
+{
+    if (std::find(target.begin(), target.end(), '|') == target.end()) {
+        target.push_back('|');
+    }
+    ptrs.push_back(&p->val);
+    target.push_back('o');
+    return target.size();
+}
+
+// The keyword names are interned once per state, so reading keyword
+// arguments does not compare or intern any strings
+template <typename T>
+size_t get_spec(mrb_state* mrb, std::vector<char>& target,
+                std::vector<void*>& ptrs, KwargsArg<T>* p)
+{
+    auto& table = FieldTable<T>::get(mrb);
+    p->kw.num = static_cast<mrb_int>(field_count<T>());
+    p->kw.required = static_cast<mrb_int>(required_count<T>());
+    p->kw.table = table.kw_syms.data();
+    p->kw.values = p->values.data();
+    p->kw.rest = nullptr;
+    ptrs.push_back(&p->kw);
+    target.push_back(':');
+    return target.size();
+}
+
 inline size_t get_spec(mrb_state*, std::vector<char>& target,
                        std::vector<void*>& ptrs, Block* p)
 {
@@ -114,12 +177,68 @@ inline size_t get_spec(mrb_state* mrb, std::vector<char>& target,
 // to_mrb and mrb_to are used to convert between C++ and ruby types as needed.
 // ie std::string <-> const char*, float <=> mrb_float
 
-template <typename T>
+template <typename T, typename = void>
 struct to_mrb
 {
     using type = T;
 };
 
+template <typename T>
+struct to_mrb<T, std::enable_if_t<has_fields<T>::value>>
+{
+    using type = mrb_value;
+};
+
+template <typename T>
+struct to_mrb<std::optional<T>>
+{
+    using type = OptionalArg;
+};
+
+template <typename T>
+struct to_mrb<Kwargs<T>>
+{
+    using type = KwargsArg<T>;
+};
+
+template <typename... T>
+struct to_mrb<std::variant<T...>>
+{
+    using type = mrb_value;
+};
+
+template <typename... T>
+struct to_mrb<std::tuple<T...>>
+{
+    using type = mrb_value;
+};
+
+template <typename A, typename B>
+struct to_mrb<std::pair<A, B>>
+{
+    using type = mrb_value;
+};
+
+// Enums are converted by value_to(), from symbols if they have a name table
+template <typename T>
+struct to_mrb<T, std::enable_if_t<std::is_enum_v<T>>>
+{
+    using type = mrb_value;
+};
+
+// Objects of registered classes are checked and converted by value_to()
+template <typename T>
+struct to_mrb<T*, std::enable_if_t<std::is_class_v<T>>>
+{
+    using type = mrb_value;
+};
+
+template <typename T>
+struct to_mrb<std::shared_ptr<T>>
+{
+    using type = mrb_value;
+};
+
 template <>
 struct to_mrb<std::string>
 {
@@ -138,16 +257,14 @@ struct to_mrb<float>
     using type = mrb_float;
 };
 
-template <>
-struct to_mrb<int>
-{
-    using type = mrb_int;
-};
-
-template <>
-struct to_mrb<unsigned int>
+// Integers are read as mrb_int when it holds every value of the type, and
+// otherwise by value_to(), which takes the floats that integers too large
+// for mrb_int are stored as
+template <typename T>
+struct to_mrb<T, std::enable_if_t<std::is_integral_v<T> &&
+                                  !std::is_same_v<T, bool>>>
 {
-    using type = mrb_int;
+    using type = std::conditional_t<fits_mrb_int<T>(), mrb_int, mrb_value>;
 };
 
 template <>
@@ -187,6 +304,21 @@ struct to_mrb<std::unordered_map<KEY, VAL>>
     using type = mrb_value;
 };
 
+template <typename T>
+Kwargs<T> kwargs_to(KwargsArg<T> const& arg, mrb_state* mrb)
+{
+    constexpr auto pos = keyword_positions<T>();
+    Kwargs<T> result;
+    std::apply(
+        [&](auto const&... f) {
+            size_t i = 0;
+            ((copy_field(result.value.*(f.ptr), arg.values[pos[i++]], mrb)),
+             ...);
+        },
+        Fields<T>::value);
+    return result;
+}
+
 template <typename TARGET, typename SOURCE>
 auto mrb_to(SOURCE const& s, mrb_state* mrb)
 {
@@ -200,6 +332,10 @@ auto mrb_to(SOURCE const& s, mrb_state* mrb)
         return Value{mrb, s};
     } else if constexpr (std::is_same_v<mrb_value, SOURCE>) {
         return value_to<TARGET>(s, mrb);
+    } else if constexpr (std::is_same_v<OptionalArg, SOURCE>) {
+        return value_to<TARGET>(s.val, mrb);
+    } else if constexpr (is_kwargs<TARGET>()) {
+        return kwargs_to<typename TARGET::type>(s, mrb);
     } else if constexpr (std::is_pointer_v<SOURCE> && std::is_same_v<std::remove_pointer_t<SOURCE> , TARGET>) {
         return *s;
     } else {
@@ -221,21 +357,86 @@ template <typename Target,
 auto self_to(mrb_value self)
 {
     using T = std::remove_const_t<std::remove_reference_t<Target>>;
-    return *static_cast<T*>(
-        (static_cast<struct RData*>(mrb_ptr(self)))->data);
+    return *native_ptr<T>(self);
 }
 
 template <typename Target,
           std::enable_if_t<std::is_pointer_v<Target>, bool> = true>
 Target self_to(mrb_value self)
 {
-    return static_cast<Target>(
-        (static_cast<struct RData*>(mrb_ptr(self)))->data);
+    return native_ptr<std::remove_const_t<std::remove_pointer_t<Target>>>(
+        self);
+}
+
+template <typename T>
+constexpr size_t keyword_count()
+{
+    if constexpr (is_kwargs<T>()) {
+        return field_count<typename T::type>();
+    } else {
+        return 0;
+    }
+}
+
+//! True unless a required positional argument follows a std::optional
+//! one. mruby marks everything after the first optional argument as
+//! optional, so a required argument there could be left out.
+template <class... ARGS>
+constexpr bool optional_args_trailing()
+{
+    constexpr std::array<bool, sizeof...(ARGS) + 1> optional{
+        is_optional<std::decay_t<ARGS>>()..., false};
+    constexpr std::array<bool, sizeof...(ARGS) + 1> positional{
+        !(is_optional<std::decay_t<ARGS>>() ||
+          is_kwargs<std::decay_t<ARGS>>() ||
+          std::is_same_v<std::decay_t<ARGS>, mrb_state*> ||
+          std::is_same_v<std::decay_t<ARGS>, Block>)...,
+        false};
+    bool seen = false;
+    for (size_t i = 0; i < sizeof...(ARGS); i++) {
+        if (optional[i]) { seen = true; }
+        if (seen && positional[i]) { return false; }
+    }
+    return true;
+}
+
+//! The number of arguments that must be given to a function taking ARGS;
+//! all but trailing std::optional and keyword arguments
+template <class... ARGS>
+constexpr size_t required_args()
+{
+    static_assert(optional_args_trailing<ARGS...>(),
+                  "std::optional arguments must come after required ones");
+    constexpr std::array<bool, sizeof...(ARGS) + 1> skip{
+        (is_optional<std::decay_t<ARGS>>() ||
+         is_kwargs<std::decay_t<ARGS>>())...,
+        false};
+    size_t req = sizeof...(ARGS);
+    while (req > 0 && skip[req - 1]) {
+        req--;
+    }
+    return req;
+}
+
+//! The mruby arity of a function taking ARGS. Trailing std::optional
+//! arguments are optional.
+template <class... ARGS>
+constexpr mrb_aspec args_aspec()
+{
+    constexpr size_t keys =
+        (size_t{0} + ... + keyword_count<std::decay_t<ARGS>>());
+    constexpr size_t positional =
+        (size_t{0} + ... + (is_kwargs<std::decay_t<ARGS>>() ? 0 : 1));
+    constexpr size_t req = required_args<ARGS...>();
+    return MRB_ARGS_ARG(req, positional - req) |
+           (keys > 0 ? MRB_ARGS_KEY(keys, 0) : MRB_ARGS_NONE());
 }
 
 template <class... ARGS, size_t... A>
 auto get_args(mrb_state* mrb, int* num, std::index_sequence<A...>)
 {
+    static_assert(optional_args_trailing<ARGS...>(),
+                  "std::optional arguments must come after required ones");
     // A tuple to store the arguments. Types are converted to corresponding
     // types that mruby can handle (ie std::string becomes const char *)
     std::tuple<typename to_mrb<ARGS>::type...> target;
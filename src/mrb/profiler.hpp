@@ -0,0 +1,202 @@
+#pragma once
+
+#include "base.hpp"
+
+extern "C"
+{
+#include <mruby/debug.h>
+#include <mruby/irep.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace mrb {
+
+// A sampling profiler for the ruby code running in one state. A timer thread
+// marks when a sample is due, and the next instruction fetched by the VM
+// records the ruby call stack; every frame as `method file:line`, with C
+// functions (including everything bound by this library) as
+// `method [native]`. Time spent in native code is attributed to the ruby
+// line that called it, as no instructions are fetched until it returns.
+//
+// Needs mruby, and everything including it, built with MRB_USE_DEBUG_HOOK
+// (the MRB_PROFILER CMake option). The per instruction cost while profiling
+// is a couple of relaxed atomic loads. Start and stop the profiler from the
+// thread running the state, or while it is idle.
+class Profiler
+{
+    using Clock = std::chrono::steady_clock;
+
+    mrb_state* mrb;
+    std::chrono::microseconds interval;
+    std::atomic<bool> due{false};
+    std::atomic<bool> running{false};
+    std::thread timer;
+    std::unordered_map<std::string, size_t> stacks;
+    size_t count = 0;
+    std::string frame_buf;
+
+#ifdef MRB_USE_DEBUG_HOOK
+    using Hook = decltype(mrb_state::code_fetch_hook);
+    Hook prev_hook = nullptr;
+
+    // Active profilers; changed rarely, so the hook caches its last lookup
+    // per thread and only locks when the generation has changed
+    static inline std::mutex lock;
+    static inline std::unordered_map<mrb_state*, Profiler*> active;
+    static inline std::atomic<uint64_t> generation{1};
+
+    static Profiler* find(mrb_state* m)
+    {
+        thread_local uint64_t seen = 0;
+        thread_local mrb_state* state = nullptr;
+        thread_local Profiler* profiler = nullptr;
+        auto gen = generation.load(std::memory_order_acquire);
+        if (gen != seen || m != state) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = active.find(m);
+            profiler = it == active.end() ? nullptr : it->second;
+            state = m;
+            seen = gen;
+        }
+        return profiler;
+    }
+
+    static void hook(mrb_state* m, mrb_irep const* irep, mrb_code const* pc,
+                     mrb_value* regs)
+    {
+        auto* p = find(m);
+        if (p == nullptr) { return; }
+        if (p->prev_hook != nullptr) { p->prev_hook(m, irep, pc, regs); }
+        if (p->due.load(std::memory_order_relaxed)) {
+            p->due.store(false, std::memory_order_relaxed);
+            p->sample(irep, pc);
+        }
+    }
+#endif
+
+    void add_frame(std::string& stack, mrb_callinfo const* ci,
+                   mrb_irep const* irep, mrb_code const* pc)
+    {
+        if (!stack.empty()) { stack += ';'; }
+        stack += ci->mid == 0 ? "<main>" : mrb_sym_name(mrb, ci->mid);
+        if (irep == nullptr) {
+            stack += " [native]";
+            return;
+        }
+        auto off = pc == nullptr ? 0 : static_cast<uint32_t>(pc - irep->iseq);
+        auto const* file = mrb_debug_get_filename(mrb, irep, off);
+        stack += ' ';
+        stack += file == nullptr ? "?" : file;
+        stack += ':';
+        stack += std::to_string(mrb_debug_get_line(mrb, irep, off));
+    }
+
+    void sample(mrb_irep const* irep, mrb_code const* pc)
+    {
+        auto& stack = frame_buf;
+        stack.clear();
+        auto const* top = mrb->c->ci;
+        for (auto const* ci = mrb->c->cibase; ci <= top; ci++) {
+            // C functions may be called without a proc
+            if (ci->proc == nullptr && ci->mid == 0) { continue; }
+            if (ci->proc == nullptr || MRB_PROC_CFUNC_P(ci->proc)) {
+                add_frame(stack, ci, nullptr, nullptr);
+            } else if (ci == top) {
+                add_frame(stack, ci, irep, pc);
+            } else {
+                auto const* ci_irep = ci->proc->body.irep;
+                add_frame(stack, ci, ci_irep, ci->pc);
+            }
+        }
+        stacks[stack]++;
+        count++;
+    }
+
+public:
+    explicit Profiler(mrb_state* _mrb, std::chrono::microseconds _interval =
+                                           std::chrono::milliseconds(1))
+        : mrb(_mrb), interval(_interval)
+    {}
+
+    ~Profiler() { stop(); }
+
+    Profiler(Profiler const&) = delete;
+    Profiler& operator=(Profiler const&) = delete;
+
+    //! Start sampling. Throws mrb_exception if mruby was built without
+    //! MRB_USE_DEBUG_HOOK.
+    void start()
+    {
+#ifdef MRB_USE_DEBUG_HOOK
+        if (running) { return; }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!active.emplace(mrb, this).second) {
+                throw mrb_exception("The state is already being profiled");
+            }
+            generation++;
+        }
+        prev_hook = mrb->code_fetch_hook;
+        mrb->code_fetch_hook = &hook;
+        running = true;
+        timer = std::thread([this] {
+            auto next = Clock::now();
+            while (running) {
+                next += interval;
+                std::this_thread::sleep_until(next);
+                due.store(true, std::memory_order_relaxed);
+            }
+        });
+#else
+        throw mrb_exception(
+            "The profiler needs mruby built with MRB_USE_DEBUG_HOOK");
+#endif
+    }
+
+    void stop()
+    {
+#ifdef MRB_USE_DEBUG_HOOK
+        if (!running) { return; }
+        running = false;
+        timer.join();
+        mrb->code_fetch_hook = prev_hook;
+        std::lock_guard<std::mutex> guard(lock);
+        active.erase(mrb);
+        generation++;
+#endif
+    }
+
+    [[nodiscard]] bool is_running() const { return running; }
+
+    //! Number of samples taken
+    [[nodiscard]] size_t samples() const { return count; }
+
+    //! The samples as collapsed stacks, one `frame;frame;frame count` line
+    //! per distinct stack, as read by flamegraph.pl and compatible tools
+    [[nodiscard]] std::string collapsed() const
+    {
+        std::string out;
+        for (auto const& [stack, n] : stacks) {
+            out += stack;
+            out += ' ';
+            out += std::to_string(n);
+            out += '\n';
+        }
+        return out;
+    }
+
+    void clear()
+    {
+        stacks.clear();
+        count = 0;
+    }
+};
+
+} // namespace mrb
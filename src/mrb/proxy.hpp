@@ -0,0 +1,207 @@
+#pragma once
+
+#include "conv.hpp"
+#include "get_args.hpp"
+
+#include <array>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace mrb {
+
+// A ContainerProxy is what ruby sees when a container field is exposed with
+// attr_proxy(). It points into the live native container, so reads and
+// writes from ruby do not copy the whole container.
+template <typename M>
+struct ContainerProxy
+{
+    M* container;
+};
+
+namespace detail {
+
+template <typename M>
+using container_t = std::remove_const_t<M>;
+
+template <typename M>
+constexpr bool is_proxy_sequence =
+    is_std_vector<container_t<M>>() || is_std_array<container_t<M>>();
+
+template <typename M>
+M& proxy_container(mrb_value self)
+{
+    return *static_cast<ContainerProxy<M>*>(DATA_PTR(self))->container;
+}
+
+// Convert a ruby index to a position in a sequence, or -1 if out of range.
+// Negative indices count from the end like they do for ruby arrays
+template <typename M>
+mrb_int proxy_index(M const& c, mrb_value index, mrb_state* mrb)
+{
+    auto i = value_to<mrb_int>(index, mrb);
+    auto size = static_cast<mrb_int>(c.size());
+    if (i < 0) {
+        i += size;
+    }
+    return i >= 0 && i < size ? i : -1;
+}
+
+template <typename M>
+mrb_value proxy_get(mrb_state* mrb, mrb_value self)
+{
+    mrb_value key;
+    mrb_get_args(mrb, "o", &key);
+    auto& c = proxy_container<M>(self);
+    if constexpr (is_proxy_sequence<M>) {
+        auto i = proxy_index(c, key, mrb);
+        if (i < 0) {
+            return mrb_nil_value();
+        }
+        typename container_t<M>::value_type const& v = c[i];
+        return to_value(v, mrb);
+    } else {
+        using key_type = typename container_t<M>::key_type;
+        auto it = c.find(value_to<key_type>(key, mrb));
+        return it == c.end() ? mrb_nil_value() : to_value(it->second, mrb);
+    }
+}
+
+template <typename M>
+mrb_value proxy_set(mrb_state* mrb, mrb_value self)
+{
+    mrb_value key;
+    mrb_value val;
+    mrb_get_args(mrb, "oo", &key, &val);
+    auto& c = proxy_container<M>(self);
+    if constexpr (is_proxy_sequence<M>) {
+        auto i = proxy_index(c, key, mrb);
+        if (i < 0) {
+            mrb_raise(mrb, E_INDEX_ERROR, "index out of range");
+        }
+        c[i] = value_to<typename container_t<M>::value_type>(val, mrb);
+    } else {
+        using key_type = typename container_t<M>::key_type;
+        using val_type = typename container_t<M>::mapped_type;
+        c[value_to<key_type>(key, mrb)] = value_to<val_type>(val, mrb);
+    }
+    return val;
+}
+
+template <typename M>
+mrb_value proxy_size(mrb_state* mrb, mrb_value self)
+{
+    return to_value(proxy_container<M>(self).size(), mrb);
+}
+
+template <typename M>
+mrb_value proxy_each(mrb_state* mrb, mrb_value self)
+{
+    mrb_value blk;
+    mrb_get_args(mrb, "&", &blk);
+    if (mrb_nil_p(blk)) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+    }
+    // The block may write to the container through the proxy, so no
+    // iterators are held across a yield; elements are looked up again by
+    // index, or by key from a copy of the keys
+    auto& c = proxy_container<M>(self);
+    auto arena = mrb_gc_arena_save(mrb);
+    if constexpr (is_proxy_sequence<M>) {
+        for (size_t i = 0; i < c.size(); i++) {
+            typename container_t<M>::value_type const& e = c[i];
+            mrb_yield(mrb, blk, to_value(e, mrb));
+            mrb_gc_arena_restore(mrb, arena);
+        }
+    } else {
+        std::vector<typename container_t<M>::key_type> keys;
+        keys.reserve(c.size());
+        for (auto const& e : c) {
+            keys.push_back(e.first);
+        }
+        for (auto const& key : keys) {
+            auto it = c.find(key);
+            if (it == c.end()) { continue; }
+            std::array<mrb_value, 2> kv{to_value(key, mrb),
+                                        to_value(it->second, mrb)};
+            mrb_yield_argv(mrb, blk, 2, kv.data());
+            mrb_gc_arena_restore(mrb, arena);
+        }
+    }
+    return self;
+}
+
+template <typename M>
+mrb_value proxy_keys(mrb_state* mrb, mrb_value self)
+{
+    auto& c = proxy_container<M>(self);
+    auto keys = mrb_ary_new_capa(mrb, static_cast<mrb_int>(c.size()));
+    auto arena = mrb_gc_arena_save(mrb);
+    mrb_int i = 0;
+    for (auto const& e : c) {
+        if constexpr (is_proxy_sequence<M>) {
+            mrb_ary_push(mrb, keys, to_value(i++, mrb));
+        } else {
+            mrb_ary_push(mrb, keys, to_value(e.first, mrb));
+        }
+        mrb_gc_arena_restore(mrb, arena);
+    }
+    return keys;
+}
+
+template <typename M>
+mrb_value proxy_to_a(mrb_state* mrb, mrb_value self)
+{
+    return to_value(proxy_container<M>(self), mrb);
+}
+
+// The proxy class is created the first time a container of a given type is
+// exposed in a state. It is anonymous, so it is registered with the GC to
+// keep it alive, and forgotten when the state is closed.
+template <typename M>
+RClass* proxy_class(mrb_state* mrb)
+{
+    auto& classes = Lookup<ContainerProxy<M>>::rclasses;
+    auto it = classes.find(mrb);
+    if (it != classes.end() && it->second.rclass != nullptr) {
+        return it->second.rclass;
+    }
+    auto* rclass = mrb_class_new(mrb, mrb->object_class);
+    mrb_gc_register(mrb, mrb_obj_value(rclass));
+    register_class<ContainerProxy<M>>(mrb, rclass, "ContainerProxy");
+    mrb_state_atexit(mrb, [](mrb_state* m) {
+        Lookup<ContainerProxy<M>>::rclasses.erase(m);
+    });
+
+    mrb_define_method(mrb, rclass, "[]", &proxy_get<M>, MRB_ARGS_REQ(1));
+    if constexpr (!std::is_const_v<M>) {
+        mrb_define_method(mrb, rclass, "[]=", &proxy_set<M>, MRB_ARGS_REQ(2));
+    }
+    mrb_define_method(mrb, rclass, "size", &proxy_size<M>, MRB_ARGS_NONE());
+    mrb_define_method(mrb, rclass, "each", &proxy_each<M>, MRB_ARGS_BLOCK());
+    mrb_define_method(mrb, rclass, "keys", &proxy_keys<M>, MRB_ARGS_NONE());
+    if constexpr (is_proxy_sequence<M>) {
+        mrb_define_method(mrb, rclass, "to_a", &proxy_to_a<M>,
+                          MRB_ARGS_NONE());
+    }
+    return rclass;
+}
+
+} // namespace detail
+
+//! Create a ruby object that refers to the native container `c`. `owner` is
+//! the ruby object that owns the container, and is kept alive for as long as
+//! the proxy is.
+template <typename M>
+mrb_value make_proxy(mrb_state* mrb, M* c, mrb_value owner)
+{
+    static_assert(is_map<detail::container_t<M>>() ||
+                      detail::is_proxy_sequence<M>,
+                  "Only maps, vectors and arrays can be proxied");
+    detail::proxy_class<M>(mrb);
+    auto obj = wrap_data(mrb, new ContainerProxy<M>{c}, Holder::Owned);
+    mrb_iv_set(mrb, obj, sym<names::owner>(mrb), owner);
+    return obj;
+}
+
+} // namespace mrb
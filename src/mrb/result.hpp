@@ -0,0 +1,164 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mrb {
+
+namespace detail {
+
+// Expires when the state is closed, for objects that may outlive it
+struct StateAlive
+{
+    std::shared_ptr<int> token = std::make_shared<int>();
+};
+
+inline std::weak_ptr<int> state_alive(mrb_state* mrb)
+{
+    return StateMap<StateAlive>::get(mrb, [] { return StateAlive{}; }).token;
+}
+
+} // namespace detail
+
+//! A ruby exception, as returned by the non throwing API. Holds on to the
+//! exception object, and only formats its message and backtrace when they
+//! are asked for, so errors that are handled without looking at them are
+//! cheap. An Error may outlive its state, but once the state is closed only
+//! what was already formatted is available.
+class Error
+{
+    std::shared_ptr<void> pin;
+    std::weak_ptr<int> alive;
+    mrb_state* mrb = nullptr;
+    mrb_value exc{};
+    mutable std::optional<std::string> msg;
+    mutable std::optional<std::vector<std::string>> trace;
+
+    [[nodiscard]] bool closed() const { return alive.expired(); }
+
+public:
+    Error(mrb_state* _mrb, mrb_value e)
+        : alive(detail::state_alive(_mrb)), mrb(_mrb), exc(e)
+    {
+        mrb_gc_register(mrb, exc);
+        pin = std::shared_ptr<void>(nullptr, [m = mrb, e, a = alive](void*) {
+            if (!a.expired()) { mrb_gc_unregister(m, e); }
+        });
+    }
+
+    //! Take the pending exception of `mrb`, clearing it
+    static Error take(mrb_state* mrb)
+    {
+        auto e = mrb_obj_value(mrb->exc);
+        mrb->exc = nullptr;
+        return {mrb, e};
+    }
+
+    //! The exception object; only valid while the state is open
+    [[nodiscard]] mrb_value exception() const { return exc; }
+
+    //! The class of the exception, or nullptr once the state is closed
+    [[nodiscard]] RClass* exception_class() const
+    {
+        return closed() ? nullptr : mrb_obj_class(mrb, exc);
+    }
+
+    //! The exception, as given by `inspect`
+    [[nodiscard]] std::string const& message() const
+    {
+        if (!msg && closed()) { msg = "exception of a closed state"; }
+        if (!msg) {
+            auto obj = mrb_funcall_argv(mrb, exc, sym<names::inspect>(mrb), 0,
+                                        nullptr);
+            msg = std::string(RSTRING_PTR(obj), RSTRING_LEN(obj));
+        }
+        return *msg;
+    }
+
+    [[nodiscard]] std::vector<std::string> const& backtrace() const
+    {
+        if (!trace) {
+            trace.emplace();
+            if (closed()) { return *trace; }
+            auto bt = mrb_funcall_argv(mrb, exc, sym<names::backtrace>(mrb), 0,
+                                       nullptr);
+            if (mrb_array_p(bt)) {
+                for (int i = 0; i < ARY_LEN(mrb_ary_ptr(bt)); i++) {
+                    auto s = mrb_funcall_argv(mrb, mrb_ary_entry(bt, i),
+                                              sym<names::to_s>(mrb), 0, nullptr);
+                    trace->emplace_back(RSTRING_PTR(s), RSTRING_LEN(s));
+                }
+            }
+        }
+        return *trace;
+    }
+
+    //! The message followed by the backtrace, one line each
+    [[nodiscard]] std::string what() const
+    {
+        auto text = message() + "\n";
+        for (auto const& line : backtrace()) {
+            text += line;
+            text += "\n";
+        }
+        return text;
+    }
+};
+
+//! Either a value or an Error
+template <typename T>
+class Result
+{
+    std::optional<T> val;
+    std::optional<Error> err;
+
+public:
+    Result(T v) : val(std::move(v)) {}     // NOLINT
+    Result(Error e) : err(std::move(e)) {}     // NOLINT
+
+    [[nodiscard]] bool ok() const { return val.has_value(); }
+    explicit operator bool() const { return ok(); }
+
+    [[nodiscard]] Error const& error() const { return *err; }
+
+    //! The value, or throws mrb_exception if this is an error
+    T& value()
+    {
+        if (err) {
+            throw mrb_exception(err->what());
+        }
+        return *val;
+    }
+
+    T value_or(T other) const { return val ? *val : std::move(other); }
+};
+
+template <>
+class Result<void>
+{
+    std::optional<Error> err;
+
+public:
+    Result() = default;
+    Result(Error e) : err(std::move(e)) {} // NOLINT
+
+    [[nodiscard]] bool ok() const { return !err.has_value(); }
+    explicit operator bool() const { return ok(); }
+
+    [[nodiscard]] Error const& error() const { return *err; }
+
+    //! Throws mrb_exception if this is an error
+    void value() const
+    {
+        if (err) {
+            throw mrb_exception(err->what());
+        }
+    }
+};
+
+} // namespace mrb
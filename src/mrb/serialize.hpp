@@ -0,0 +1,806 @@
+#pragma once
+
+#include "base.hpp"
+
+extern "C"
+{
+#include <mruby/hash.h>
+}
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <locale>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Encoding of ruby values as MessagePack or JSON, and decoding back to ruby
+// values, without converting to STL containers in between.
+
+namespace mrb {
+
+enum class Format
+{
+    MessagePack,
+    Json
+};
+
+namespace detail {
+
+// JSON numbers are written and read the same whatever the C locale says the
+// decimal point is. std::to_chars() and std::from_chars() do that, where the
+// standard library has them for doubles; streams in the classic locale do it
+// elsewhere.
+
+//! Write the shortest text that reads back as `f` to `text`, which must hold
+//! 32 characters, and return its length
+inline size_t format_real(double f, char* text)
+{
+#ifdef __cpp_lib_to_chars
+    return static_cast<size_t>(std::to_chars(text, text + 32, f).ptr - text);
+#else
+    std::ostringstream os;
+    os.imbue(std::locale::classic());
+    for (int precision : {15, 17}) {
+        os.str({});
+        os.precision(precision);
+        os << f;
+        double back = 0;
+        std::istringstream is(os.str());
+        is.imbue(std::locale::classic());
+        if (is >> back && back == f) { break; }
+    }
+    auto const s = os.str();
+    std::memcpy(text, s.data(), s.size());
+    return s.size();
+#endif
+}
+
+//! Read all of [first, last) as a double. False if it is not a number, or
+//! too large for a double; numbers too small for one read as zero.
+inline bool parse_real(const char* first, const char* last, double& f)
+{
+#ifdef __cpp_lib_to_chars
+    auto [ptr, ec] = std::from_chars(first, last, f);
+    if (ec != std::errc::result_out_of_range) {
+        return ec == std::errc() && ptr == last;
+    }
+    // from_chars() fails on underflow too, which the stream reads as zero
+#endif
+    std::istringstream is(std::string(first, last));
+    is.imbue(std::locale::classic());
+    return is >> f && is.peek() == std::char_traits<char>::eof() &&
+           std::isfinite(f);
+}
+
+} // namespace detail
+
+//! Writes values to a string, appending to whatever it holds. Reuse the
+//! string, cleared, to avoid allocating for every message.
+//!
+//! Containers are written with begin_array() or begin_map() followed by
+//! their items; for maps, keys and values alternate. They are closed
+//! automatically after the given number of items.
+class Encoder
+{
+public:
+    //! Called for values that have no encoding, like objects of bound
+    //! classes. Write exactly one value with the encoder and return true,
+    //! or return false to fail.
+    using Hook = std::function<bool(Encoder&, mrb_value)>;
+
+    //! Nesting deeper than this fails, which also catches cycles
+    static constexpr size_t max_depth = 128;
+
+private:
+    struct Frame
+    {
+        size_t size;
+        size_t written;
+        bool map;
+    };
+
+    mrb_state* mrb;
+    Format format;
+    std::string& out;
+    Hook hook;
+    std::vector<Frame> frames; // Open JSON containers
+    size_t depth = 0;
+
+    [[nodiscard]] bool key_position() const
+    {
+        return !frames.empty() && frames.back().map &&
+               frames.back().written % 2 == 0;
+    }
+
+    // JSON separator before an item
+    void before()
+    {
+        if (frames.empty()) { return; }
+        auto const& f = frames.back();
+        if (f.map && f.written % 2 == 1) {
+            out += ':';
+        } else if (f.written > 0) {
+            out += ',';
+        }
+    }
+
+    // Count a finished item, closing the containers it completes
+    void after()
+    {
+        while (!frames.empty()) {
+            auto& f = frames.back();
+            if (++f.written < f.size) { return; }
+            out += f.map ? '}' : ']';
+            frames.pop_back();
+        }
+    }
+
+    template <typename T>
+    void put_be(uint8_t tag, T v)
+    {
+        out += static_cast<char>(tag);
+        for (auto shift = static_cast<int>(sizeof(T) * 8) - 8; shift >= 0;
+             shift -= 8) {
+            out += static_cast<char>((static_cast<uint64_t>(v) >> shift) & 0xff);
+        }
+    }
+
+    void put_length(size_t n, uint8_t fix, size_t fix_max, uint8_t tag8,
+                    uint8_t tag16, uint8_t tag32)
+    {
+        if (n <= fix_max) {
+            out += static_cast<char>(fix | n);
+        } else if (tag8 != 0 && n <= 0xff) {
+            put_be(tag8, static_cast<uint8_t>(n));
+        } else if (n <= 0xffff) {
+            put_be(tag16, static_cast<uint16_t>(n));
+        } else if (n <= 0xffffffff) {
+            put_be(tag32, static_cast<uint32_t>(n));
+        } else {
+            throw mrb_exception("too large for MessagePack");
+        }
+    }
+
+    void json_string(std::string_view s)
+    {
+        out += '"';
+        for (auto ch : s) {
+            auto c = static_cast<unsigned char>(ch);
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char hex[8];
+                    std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+                    out += hex;
+                } else {
+                    out += ch;
+                }
+            }
+        }
+        out += '"';
+    }
+
+    void begin(size_t n, bool map)
+    {
+        if (format == Format::MessagePack) {
+            if (map) {
+                put_length(n, 0x80, 15, 0, 0xde, 0xdf);
+            } else {
+                put_length(n, 0x90, 15, 0, 0xdc, 0xdd);
+            }
+            return;
+        }
+        before();
+        out += map ? '{' : '[';
+        auto size = map ? n * 2 : n;
+        if (size == 0) {
+            out += map ? '}' : ']';
+            after();
+        } else {
+            frames.push_back({size, 0, map});
+        }
+    }
+
+    struct HashWalk
+    {
+        Encoder* enc;
+        std::exception_ptr error;
+    };
+
+    // Exceptions must not unwind through mruby, so they are passed on
+    static int hash_item(mrb_state*, mrb_value key, mrb_value val, void* data)
+    {
+        auto& walk = *static_cast<HashWalk*>(data);
+        try {
+            walk.enc->value(key);
+            walk.enc->value(val);
+        } catch (...) {
+            walk.error = std::current_exception();
+            return 1;
+        }
+        return 0;
+    }
+
+public:
+    Encoder(mrb_state* _mrb, Format _format, std::string& _out,
+            Hook _hook = {})
+        : mrb(_mrb), format(_format), out(_out), hook(std::move(_hook))
+    {}
+
+    void nil()
+    {
+        if (format == Format::MessagePack) {
+            out += static_cast<char>(0xc0);
+            return;
+        }
+        before();
+        out += "null";
+        after();
+    }
+
+    void boolean(bool b)
+    {
+        if (format == Format::MessagePack) {
+            out += static_cast<char>(b ? 0xc3 : 0xc2);
+            return;
+        }
+        before();
+        out += b ? "true" : "false";
+        after();
+    }
+
+    void integer(int64_t i)
+    {
+        if (format == Format::MessagePack) {
+            if (i >= 0) {
+                if (i < 0x80) {
+                    out += static_cast<char>(i);
+                } else if (i <= 0xff) {
+                    put_be(0xcc, static_cast<uint8_t>(i));
+                } else if (i <= 0xffff) {
+                    put_be(0xcd, static_cast<uint16_t>(i));
+                } else if (i <= 0xffffffff) {
+                    put_be(0xce, static_cast<uint32_t>(i));
+                } else {
+                    put_be(0xcf, static_cast<uint64_t>(i));
+                }
+            } else if (i >= -32) {
+                out += static_cast<char>(i);
+            } else if (i >= INT8_MIN) {
+                put_be(0xd0, static_cast<int8_t>(i));
+            } else if (i >= INT16_MIN) {
+                put_be(0xd1, static_cast<int16_t>(i));
+            } else if (i >= INT32_MIN) {
+                put_be(0xd2, static_cast<int32_t>(i));
+            } else {
+                put_be(0xd3, i);
+            }
+            return;
+        }
+        before();
+        // JSON object keys must be strings
+        auto quote = key_position();
+        char text[24];
+        std::snprintf(text, sizeof(text), quote ? "\"%lld\"" : "%lld",
+                      static_cast<long long>(i));
+        out += text;
+        after();
+    }
+
+    void real(double f)
+    {
+        if (format == Format::MessagePack) {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &f, sizeof(bits));
+            put_be(0xcb, bits);
+            return;
+        }
+        if (!std::isfinite(f)) {
+            throw mrb_exception("NaN and Infinity can not be encoded as JSON");
+        }
+        before();
+        char text[32];
+        std::string_view const real(text, detail::format_real(f, text));
+        out += real;
+        // Keep it a float when read back
+        if (real.find_first_of(".eE") == std::string_view::npos) {
+            out += ".0";
+        }
+        after();
+    }
+
+    void string(std::string_view s)
+    {
+        if (format == Format::MessagePack) {
+            put_length(s.size(), 0xa0, 31, 0xd9, 0xda, 0xdb);
+            out.append(s.data(), s.size());
+            return;
+        }
+        before();
+        json_string(s);
+        after();
+    }
+
+    void begin_array(size_t n) { begin(n, false); }
+    void begin_map(size_t n) { begin(n, true); }
+
+    //! Write `v` and everything it contains
+    void value(mrb_value v)
+    {
+        auto type = mrb_type(v);
+        // JSON object keys must be strings; integers are written as strings
+        if (format == Format::Json && key_position() &&
+            (type == MRB_TT_FALSE || type == MRB_TT_TRUE ||
+             type == MRB_TT_FLOAT || type == MRB_TT_ARRAY ||
+             type == MRB_TT_HASH)) {
+            throw mrb_exception(
+                std::string("can not encode JSON object key of class ") +
+                mrb_obj_classname(mrb, v));
+        }
+        switch (type) {
+        case MRB_TT_FALSE:
+            if (mrb_nil_p(v)) {
+                nil();
+            } else {
+                boolean(false);
+            }
+            return;
+        case MRB_TT_TRUE: boolean(true); return;
+        case MRB_TT_INTEGER: integer(mrb_integer(v)); return;
+        case MRB_TT_FLOAT: real(mrb_float(v)); return;
+        case MRB_TT_STRING:
+            string({RSTRING_PTR(v), static_cast<size_t>(RSTRING_LEN(v))});
+            return;
+        case MRB_TT_SYMBOL: {
+            mrb_int len = 0;
+            auto const* name = mrb_sym_name_len(mrb, mrb_symbol(v), &len);
+            string({name, static_cast<size_t>(len)});
+            return;
+        }
+        case MRB_TT_ARRAY: {
+            if (++depth > max_depth) { throw mrb_exception("nesting too deep"); }
+            auto const* ary = mrb_ary_ptr(v);
+            auto len = ARY_LEN(ary);
+            begin_array(static_cast<size_t>(len));
+            for (mrb_int i = 0; i < len; i++) {
+                value(mrb_ary_entry(v, i));
+            }
+            depth--;
+            return;
+        }
+        case MRB_TT_HASH: {
+            if (++depth > max_depth) { throw mrb_exception("nesting too deep"); }
+            begin_map(static_cast<size_t>(mrb_hash_size(mrb, v)));
+            HashWalk walk{this, nullptr};
+            mrb_hash_foreach(mrb, mrb_hash_ptr(v), &hash_item, &walk);
+            if (walk.error) { std::rethrow_exception(walk.error); }
+            depth--;
+            return;
+        }
+        default: break;
+        }
+        if (hook && hook(*this, v)) { return; }
+        throw mrb_exception(std::string("can not encode object of class ") +
+                            mrb_obj_classname(mrb, v));
+    }
+};
+
+namespace detail {
+
+class MessagePackReader
+{
+    mrb_state* mrb;
+    unsigned char const* p;
+    unsigned char const* end;
+
+    [[noreturn]] static void fail(const char* what)
+    {
+        throw mrb_exception(std::string("invalid MessagePack: ") + what);
+    }
+
+    void need(size_t n) const
+    {
+        if (static_cast<size_t>(end - p) < n) { fail("truncated"); }
+    }
+
+    template <typename T>
+    T get_be()
+    {
+        need(sizeof(T));
+        uint64_t v = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            v = (v << 8) | *p++;
+        }
+        return static_cast<T>(v);
+    }
+
+    mrb_value str(size_t n)
+    {
+        need(n);
+        auto s = mrb_str_new(mrb, reinterpret_cast<const char*>(p), n); // NOLINT
+        p += n;
+        return s;
+    }
+
+    mrb_value array(size_t n, size_t depth)
+    {
+        // Every item takes at least one byte, so a bogus length can not make
+        // us allocate much
+        need(n);
+        auto ary = mrb_ary_new_capa(mrb, static_cast<mrb_int>(n));
+        auto arena = mrb_gc_arena_save(mrb);
+        for (size_t i = 0; i < n; i++) {
+            mrb_ary_push(mrb, ary, read(depth + 1));
+            mrb_gc_arena_restore(mrb, arena);
+        }
+        return ary;
+    }
+
+    mrb_value map(size_t n, size_t depth)
+    {
+        need(n * 2);
+        auto hash = mrb_hash_new_capa(mrb, static_cast<mrb_int>(n));
+        auto arena = mrb_gc_arena_save(mrb);
+        for (size_t i = 0; i < n; i++) {
+            auto key = read(depth + 1);
+            mrb_hash_set(mrb, hash, key, read(depth + 1));
+            mrb_gc_arena_restore(mrb, arena);
+        }
+        return hash;
+    }
+
+    mrb_value real(double f) { return mrb_float_value(mrb, static_cast<mrb_float>(f)); }
+
+    // Checked here, as integer_value() raises in ruby for a non null state
+    template <typename INT>
+    mrb_value integer(INT i)
+    {
+        if (!integer_fits(i)) { fail("integer out of range"); }
+        return integer_value(i, mrb);
+    }
+
+public:
+    MessagePackReader(mrb_state* _mrb, std::string_view data)
+        : mrb(_mrb),
+          p(reinterpret_cast<unsigned char const*>(data.data())), // NOLINT
+          end(p + data.size())
+    {}
+
+    [[nodiscard]] bool done() const { return p == end; }
+
+    mrb_value read(size_t depth = 0)
+    {
+        if (depth > Encoder::max_depth) { fail("nesting too deep"); }
+        need(1);
+        auto tag = *p++;
+        if (tag < 0x80) { return mrb_int_value(mrb, tag); }
+        if (tag >= 0xe0) {
+            return mrb_int_value(mrb, static_cast<int8_t>(tag));
+        }
+        if ((tag & 0xf0) == 0x80) { return map(tag & 0x0f, depth); }
+        if ((tag & 0xf0) == 0x90) { return array(tag & 0x0f, depth); }
+        if ((tag & 0xe0) == 0xa0) { return str(tag & 0x1f); }
+        switch (tag) {
+        case 0xc0: return mrb_nil_value();
+        case 0xc2: return mrb_false_value();
+        case 0xc3: return mrb_true_value();
+        // Binary is read as strings
+        case 0xc4:
+        case 0xd9: return str(get_be<uint8_t>());
+        case 0xc5:
+        case 0xda: return str(get_be<uint16_t>());
+        case 0xc6:
+        case 0xdb: return str(get_be<uint32_t>());
+        case 0xca: {
+            auto bits = get_be<uint32_t>();
+            float f = 0;
+            std::memcpy(&f, &bits, sizeof(f));
+            return real(f);
+        }
+        case 0xcb: {
+            auto bits = get_be<uint64_t>();
+            double f = 0;
+            std::memcpy(&f, &bits, sizeof(f));
+            return real(f);
+        }
+        case 0xcc: return integer(get_be<uint8_t>());
+        case 0xcd: return integer(get_be<uint16_t>());
+        case 0xce: return integer(get_be<uint32_t>());
+        case 0xcf: return integer(get_be<uint64_t>());
+        case 0xd0: return integer(get_be<int8_t>());
+        case 0xd1: return integer(get_be<int16_t>());
+        case 0xd2: return integer(get_be<int32_t>());
+        case 0xd3: return integer(get_be<int64_t>());
+        case 0xdc: return array(get_be<uint16_t>(), depth);
+        case 0xdd: return array(get_be<uint32_t>(), depth);
+        case 0xde: return map(get_be<uint16_t>(), depth);
+        case 0xdf: return map(get_be<uint32_t>(), depth);
+        default: fail("unsupported type");
+        }
+    }
+};
+
+class JsonReader
+{
+    mrb_state* mrb;
+    const char* p;
+    const char* end;
+
+    [[noreturn]] static void fail(const char* what)
+    {
+        throw mrb_exception(std::string("invalid JSON: ") + what);
+    }
+
+    void skip_space()
+    {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+            p++;
+        }
+    }
+
+    bool next_is(char c)
+    {
+        skip_space();
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c, const char* what)
+    {
+        if (!next_is(c)) { fail(what); }
+    }
+
+    void literal(std::string_view word)
+    {
+        if (static_cast<size_t>(end - p) < word.size() ||
+            std::string_view(p, word.size()) != word) {
+            fail("unexpected character");
+        }
+        p += word.size();
+    }
+
+    unsigned hex4()
+    {
+        if (end - p < 4) { fail("truncated escape"); }
+        unsigned v = 0;
+        for (int i = 0; i < 4; i++) {
+            auto c = *p++;
+            v <<= 4;
+            if (c >= '0' && c <= '9') {
+                v |= static_cast<unsigned>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                v |= static_cast<unsigned>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                v |= static_cast<unsigned>(c - 'A' + 10);
+            } else {
+                fail("bad escape");
+            }
+        }
+        return v;
+    }
+
+    static void utf8(std::string& s, unsigned cp)
+    {
+        if (cp < 0x80) {
+            s += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            s += static_cast<char>(0xc0 | (cp >> 6));
+            s += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            s += static_cast<char>(0xe0 | (cp >> 12));
+            s += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            s += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            s += static_cast<char>(0xf0 | (cp >> 18));
+            s += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            s += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            s += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    // Called after the opening quote
+    mrb_value string()
+    {
+        // Strings without escapes are made straight from the input
+        auto const* start = p;
+        while (p < end && *p != '"' && *p != '\\') {
+            p++;
+        }
+        if (p == end) { fail("unterminated string"); }
+        if (*p == '"') {
+            return mrb_str_new(mrb, start, static_cast<size_t>(p++ - start));
+        }
+        std::string s(start, p);
+        while (true) {
+            if (p == end) { fail("unterminated string"); }
+            auto c = *p++;
+            if (c == '"') { break; }
+            if (c != '\\') {
+                s += c;
+                continue;
+            }
+            if (p == end) { fail("unterminated string"); }
+            switch (*p++) {
+            case '"': s += '"'; break;
+            case '\\': s += '\\'; break;
+            case '/': s += '/'; break;
+            case 'b': s += '\b'; break;
+            case 'f': s += '\f'; break;
+            case 'n': s += '\n'; break;
+            case 'r': s += '\r'; break;
+            case 't': s += '\t'; break;
+            case 'u': {
+                auto cp = hex4();
+                if (cp >= 0xdc00 && cp < 0xe000) { fail("bad surrogate"); }
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    // A high surrogate must be followed by a low one
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u') {
+                        fail("bad surrogate");
+                    }
+                    p += 2;
+                    auto low = hex4();
+                    if (low < 0xdc00 || low >= 0xe000) { fail("bad surrogate"); }
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                }
+                utf8(s, cp);
+                break;
+            }
+            default: fail("bad escape");
+            }
+        }
+        return mrb_str_new(mrb, s.data(), s.size());
+    }
+
+    bool digit() const { return p < end && *p >= '0' && *p <= '9'; }
+
+    void digits()
+    {
+        if (!digit()) { fail("bad number"); }
+        while (digit()) {
+            p++;
+        }
+    }
+
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    mrb_value number()
+    {
+        auto const* start = p;
+        if (p < end && *p == '-') { p++; }
+        if (!digit()) {
+            fail(p == start ? "unexpected character" : "bad number");
+        }
+        if (*p == '0') {
+            p++;
+        } else {
+            digits();
+        }
+        bool real = false;
+        if (p < end && *p == '.') {
+            p++;
+            digits();
+            real = true;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (p < end && (*p == '+' || *p == '-')) { p++; }
+            digits();
+            real = true;
+        }
+        if (!real) {
+            int64_t i = 0;
+            auto [last, ec] = std::from_chars(start, p, i);
+            if (ec == std::errc() && last == p) {
+                if (!integer_fits(i)) { fail("integer out of range"); }
+                return integer_value(i, mrb);
+            }
+        }
+        // Reals, and integers too large for 64 bits
+        double f = 0;
+        if (!detail::parse_real(start, p, f)) { fail("number out of range"); }
+        return mrb_float_value(mrb, static_cast<mrb_float>(f));
+    }
+
+public:
+    JsonReader(mrb_state* _mrb, std::string_view data)
+        : mrb(_mrb), p(data.data()), end(p + data.size())
+    {}
+
+    [[nodiscard]] bool done()
+    {
+        skip_space();
+        return p == end;
+    }
+
+    mrb_value read(size_t depth = 0)
+    {
+        if (depth > Encoder::max_depth) { fail("nesting too deep"); }
+        skip_space();
+        if (p == end) { fail("truncated"); }
+        switch (*p) {
+        case '{': {
+            p++;
+            auto hash = mrb_hash_new(mrb);
+            auto arena = mrb_gc_arena_save(mrb);
+            if (next_is('}')) { return hash; }
+            do {
+                expect('"', "expected a string key");
+                auto key = string();
+                expect(':', "expected ':'");
+                mrb_hash_set(mrb, hash, key, read(depth + 1));
+                mrb_gc_arena_restore(mrb, arena);
+            } while (next_is(','));
+            expect('}', "expected ',' or '}'");
+            return hash;
+        }
+        case '[': {
+            p++;
+            auto ary = mrb_ary_new(mrb);
+            auto arena = mrb_gc_arena_save(mrb);
+            if (next_is(']')) { return ary; }
+            do {
+                mrb_ary_push(mrb, ary, read(depth + 1));
+                mrb_gc_arena_restore(mrb, arena);
+            } while (next_is(','));
+            expect(']', "expected ',' or ']'");
+            return ary;
+        }
+        case '"': p++; return string();
+        case 't': literal("true"); return mrb_true_value();
+        case 'f': literal("false"); return mrb_false_value();
+        case 'n': literal("null"); return mrb_nil_value();
+        default: return number();
+        }
+    }
+};
+
+} // namespace detail
+
+//! Append `v` and everything it contains to `out`. `hook` is called for
+//! values that have no encoding, like objects of bound classes. Throws
+//! mrb_exception for values that can not be encoded.
+//!
+//! std::string buf;
+//! mrb::encode(mrb, result, mrb::Format::MessagePack, buf);
+inline void encode(mrb_state* mrb, mrb_value v, Format format,
+                   std::string& out, Encoder::Hook hook = {})
+{
+    Encoder enc(mrb, format, out, std::move(hook));
+    enc.value(v);
+}
+
+//! Build ruby values from one encoded value. JSON objects become hashes with
+//! string keys, and MessagePack binary data becomes strings. Integers that
+//! do not fit in mrb_int become floats when that is exact; see
+//! integer_value(). Throws mrb_exception if `data` is not valid, has
+//! trailing data, or holds an integer that can not be represented.
+inline mrb_value decode(mrb_state* mrb, Format format, std::string_view data)
+{
+    if (format == Format::MessagePack) {
+        detail::MessagePackReader reader(mrb, data);
+        auto v = reader.read();
+        if (!reader.done()) { throw mrb_exception("invalid MessagePack: trailing data"); }
+        return v;
+    }
+    detail::JsonReader reader(mrb, data);
+    auto v = reader.read();
+    if (!reader.done()) { throw mrb_exception("invalid JSON: trailing data"); }
+    return v;
+}
+
+} // namespace mrb
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "base.hpp"
+#include "conv.hpp"
+#include "fields.hpp"
+#include "trace.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Per binding call statistics. Define MRB_BINDING_STATS to compile the
+// counters into the call glue of bound functions and methods; otherwise
+// nothing is recorded and the call glue is unchanged. The same probe records
+// trace spans for bound calls when MRB_TRACE is defined.
+//
+// Calls that raise are not recorded, neither in the statistics nor in the
+// trace: mruby raises with longjmp, which skips the CallProbe destructor.
+
+#if defined(MRB_BINDING_STATS) || defined(MRB_TRACE)
+#define MRB_CALL_PROBES
+#endif
+
+namespace mrb {
+
+//! The counters of one binding, as returned by binding_stats()
+struct BindingStat
+{
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t args_ns = 0;   //!< Time spent converting arguments
+    uint64_t native_ns = 0; //!< Time spent in the native function
+    uint64_t return_ns = 0; //!< Time spent converting the return value
+    //! Calls by total time; bucket `i` counts calls that took between 2^i
+    //! and 2^(i+1) nanoseconds
+    std::vector<uint64_t> histogram;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{field("name", &BindingStat::name),
+                          field("calls", &BindingStat::calls),
+                          field("args_ns", &BindingStat::args_ns),
+                          field("native_ns", &BindingStat::native_ns),
+                          field("return_ns", &BindingStat::return_ns),
+                          field("histogram", &BindingStat::histogram)};
+    }
+};
+
+namespace detail {
+
+constexpr size_t histogram_buckets = 32;
+
+// The live counters of a binding. They are only written by the thread
+// running the state, but may be read from any thread.
+struct BindingCounters
+{
+    std::string name;
+    const char* trace_name = nullptr; //!< `name`, as kept by the Tracer
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> args_ns{0};
+    std::atomic<uint64_t> native_ns{0};
+    std::atomic<uint64_t> return_ns{0};
+    std::array<std::atomic<uint64_t>, histogram_buckets> histogram{};
+
+    explicit BindingCounters(std::string n) : name(std::move(n))
+    {
+#ifdef MRB_TRACE
+        trace_name = Tracer::intern(name);
+#endif
+    }
+
+    void record(uint64_t args, uint64_t native, uint64_t ret)
+    {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        calls.fetch_add(1, relaxed);
+        args_ns.fetch_add(args, relaxed);
+        native_ns.fetch_add(native, relaxed);
+        return_ns.fetch_add(ret, relaxed);
+        auto total = args + native + ret;
+        size_t bucket = 0;
+        while ((total >>= 1) != 0 && bucket < histogram_buckets - 1) {
+            bucket++;
+        }
+        histogram[bucket].fetch_add(1, relaxed);
+    }
+
+    [[nodiscard]] BindingStat snapshot() const
+    {
+        BindingStat s{name, calls, args_ns, native_ns, return_ns, {}};
+        for (auto const& h : histogram) {
+            s.histogram.push_back(h);
+        }
+        return s;
+    }
+
+    // Counters live in a deque so they never move. The map, and adding to
+    // the deques, is guarded by `states_lock` so stats can be read from
+    // other threads while states bind functions or close.
+    static inline std::mutex states_lock;
+    static inline std::unordered_map<mrb_state*, std::deque<BindingCounters>>
+        states;
+
+    //! Add counters for a binding of `mrb`
+    static BindingCounters* add(mrb_state* mrb, std::string name)
+    {
+        std::lock_guard<std::mutex> guard(states_lock);
+        auto it = states.find(mrb);
+        if (it == states.end()) {
+            it = states.emplace(mrb, std::deque<BindingCounters>{}).first;
+            mrb_state_atexit(mrb, [](mrb_state* m) {
+                std::lock_guard<std::mutex> g(states_lock);
+                states.erase(m);
+            });
+        }
+        return &it->second.emplace_back(std::move(name));
+    }
+};
+
+//! The counters for a new binding of `name` in `cls`, or nullptr when
+//! statistics and tracing are disabled. `sep` is '#' for methods and '.'
+//! for class methods.
+inline BindingCounters* binding_counters([[maybe_unused]] mrb_state* mrb,
+                                         [[maybe_unused]] RClass* cls,
+                                         [[maybe_unused]] mrb_sym name,
+                                         [[maybe_unused]] char sep = '#')
+{
+#ifdef MRB_CALL_PROBES
+    std::string label = mrb_class_name(mrb, cls);
+    label += sep;
+    label += mrb_sym_name(mrb, name);
+    return BindingCounters::add(mrb, std::move(label));
+#else
+    return nullptr;
+#endif
+}
+
+#ifdef MRB_CALL_PROBES
+
+// Times the phases of one call to a bound function; create it first thing,
+// and mark the end of argument conversion and of the native call. The
+// return value conversion ends when it goes out of scope.
+class CallProbe
+{
+    using Clock = std::chrono::steady_clock;
+
+    BindingCounters* counters;
+    Clock::time_point start = Clock::now();
+    Clock::time_point mark = start;
+    uint64_t args = 0;
+    uint64_t native = 0;
+
+    uint64_t lap()
+    {
+        auto now = Clock::now();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - mark);
+        mark = now;
+        return static_cast<uint64_t>(ns.count());
+    }
+
+public:
+    // The counters are kept in the second environment slot of the proc
+    explicit CallProbe(mrb_state* mrb)
+        : counters(static_cast<BindingCounters*>(
+              mrb_cptr(mrb_proc_cfunc_env_get(mrb, 1))))
+    {}
+    CallProbe(CallProbe const&) = delete;
+    CallProbe& operator=(CallProbe const&) = delete;
+
+    void converted() { args = lap(); }
+    void called() { native = lap(); }
+    ~CallProbe()
+    {
+        [[maybe_unused]] auto ret = lap();
+#ifdef MRB_BINDING_STATS
+        counters->record(args, native, ret);
+#endif
+#ifdef MRB_TRACE
+        if (Tracer::enabled()) {
+            Tracer::add(counters->trace_name, "native", start, mark);
+        }
+#endif
+    }
+};
+
+#else
+
+class CallProbe
+{
+public:
+    explicit CallProbe(mrb_state* /*mrb*/) {}
+    void converted() {}
+    void called() {}
+};
+
+#endif
+
+} // namespace detail
+
+//! The counters of every binding in `mrb`, in the order they were bound.
+//! Empty unless MRB_BINDING_STATS is defined.
+inline std::vector<BindingStat> binding_stats(mrb_state* mrb)
+{
+    std::vector<BindingStat> result;
+#ifdef MRB_BINDING_STATS
+    std::lock_guard<std::mutex> guard(detail::BindingCounters::states_lock);
+    auto it = detail::BindingCounters::states.find(mrb);
+    if (it != detail::BindingCounters::states.end()) {
+        for (auto const& c : it->second) {
+            result.push_back(c.snapshot());
+        }
+    }
+#endif
+    return result;
+}
+
+//! Define `binding_stats` in Kernel, returning the counters as an array of
+//! hashes
+inline void define_binding_stats(mrb_state* mrb)
+{
+    mrb_define_module_function(
+        mrb, mrb->kernel_module, "binding_stats",
+        [](mrb_state* mrb, mrb_value) {
+            return to_value(binding_stats(mrb), mrb);
+        },
+        MRB_ARGS_NONE());
+}
+
+} // namespace mrb
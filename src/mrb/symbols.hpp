@@ -0,0 +1,122 @@
+#pragma once
+
+extern "C"
+{
+#include <mruby.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mrb {
+
+// Names used by the library itself. To use the symbol cache for your own
+// names, declare them the same way; `static constexpr char name[] = "...";`
+namespace names {
+inline constexpr char backtrace[] = "backtrace";
+inline constexpr char call[] = "call";
+inline constexpr char generational_mode_set[] = "generational_mode=";
+inline constexpr char inspect[] = "inspect";
+inline constexpr char method_missing[] = "method_missing";
+inline constexpr char new_[] = "new";
+inline constexpr char owner[] = "@owner";
+inline constexpr char respond_to_missing[] = "respond_to_missing?";
+inline constexpr char to_a[] = "to_a";
+inline constexpr char to_s[] = "to_s";
+} // namespace names
+
+namespace detail {
+
+// Data of type V for each state, in a map shared by all threads and erased
+// when the state is closed. A state is used by one thread at a time, but
+// each thread may run its own state. The last lookup of every thread is
+// remembered, so repeated use of one state skips the lock and the map.
+template <typename V>
+struct StateMap
+{
+    static inline std::mutex lock;
+    static inline std::unordered_map<mrb_state*, V> values;
+    // Bumped when a state is closed, so other threads drop their cached lookup
+    static inline std::atomic<uint64_t> generation{1};
+
+    //! The value of `mrb`, or nullptr if it has none
+    static V* find(mrb_state* mrb)
+    {
+        thread_local uint64_t seen = 0;
+        thread_local mrb_state* last_state = nullptr;
+        thread_local V* last = nullptr;
+        auto gen = generation.load(std::memory_order_acquire);
+        if (mrb == last_state && gen == seen) {
+            return last;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = values.find(mrb);
+        if (it == values.end()) {
+            return nullptr;
+        }
+        last_state = mrb;
+        last = &it->second;
+        seen = gen;
+        return last;
+    }
+
+    //! The value of `mrb`, created by `init()` on first use. `init` runs
+    //! without the lock held, so it may use the state.
+    template <typename INIT>
+    static V& get(mrb_state* mrb, INIT const& init)
+    {
+        if (auto* v = find(mrb)) {
+            return *v;
+        }
+        auto value = init();
+        std::lock_guard<std::mutex> guard(lock);
+        auto [it, added] = values.emplace(mrb, std::move(value));
+        if (added) {
+            mrb_state_atexit(mrb, [](mrb_state* m) {
+                std::lock_guard<std::mutex> g(lock);
+                values.erase(m);
+                generation++;
+            });
+        }
+        return it->second;
+    }
+};
+
+inline std::atomic<size_t> next_symbol_slot{0};
+
+// The interned symbols of each state, indexed by slot. Zero means not
+// interned yet, as mruby never uses it for a symbol.
+inline std::vector<mrb_sym>& symbol_cache(mrb_state* mrb)
+{
+    return StateMap<std::vector<mrb_sym>>::get(
+        mrb, [] { return std::vector<mrb_sym>{}; });
+}
+
+} // namespace detail
+
+//! Get the symbol for the string NAME in `mrb`. Each name gets a slot the
+//! first time it is used, and is interned once per state; after that this
+//! is an array lookup.
+//!
+//! static constexpr char update[] = "update";
+//! mrb_funcall_argv(mrb, obj, mrb::sym<update>(mrb), 0, nullptr);
+template <const char* NAME>
+mrb_sym sym(mrb_state* mrb)
+{
+    static size_t const slot = detail::next_symbol_slot++;
+    auto& syms = detail::symbol_cache(mrb);
+    if (slot >= syms.size()) {
+        syms.resize(slot + 1, 0);
+    }
+    auto& s = syms[slot];
+    if (s == 0) {
+        s = mrb_intern_static(mrb, NAME, std::char_traits<char>::length(NAME));
+    }
+    return s;
+}
+
+} // namespace mrb
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Tracing to Chrome trace_event JSON, viewable in chrome://tracing or
+// Perfetto. Define MRB_TRACE to compile spans into exec(), call_proc(), the
+// call glue of bound functions and the GC functions in gc.hpp; otherwise
+// TraceSpan is empty and nothing is recorded.
+
+namespace mrb {
+
+// The process wide trace writer. Events are collected in a buffer per
+// thread, and full buffers are handed to a writer thread, so recording a
+// span does not wait for the file.
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        const char* name; //!< Must outlive the trace; see intern()
+        const char* cat;
+        Clock::time_point start;
+        Clock::time_point end;
+        uint32_t tid;
+        std::string detail; //!< Shown as args.detail, if not empty
+    };
+
+private:
+    static constexpr size_t batch_size = 1024;
+
+    struct ThreadBuffer
+    {
+        std::mutex lock; // Only contended while flushing
+        std::vector<Event> events;
+        uint32_t tid = 0;
+    };
+
+    struct State
+    {
+        std::atomic<bool> enabled{false};
+        std::mutex lock;
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        std::unordered_set<std::string> names;
+        uint32_t next_tid = 1;
+
+        // Writer thread
+        std::condition_variable wake;
+        std::deque<std::vector<Event>> queue;
+        std::thread writer;
+        bool done = false;
+        FILE* out = nullptr;
+        bool first = true;
+        Clock::time_point epoch;
+    };
+
+    static State& state()
+    {
+        static State s;
+        return s;
+    }
+
+    static ThreadBuffer& buffer()
+    {
+        thread_local std::shared_ptr<ThreadBuffer> buf = [] {
+            auto& s = state();
+            auto b = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> guard(s.lock);
+            b->tid = s.next_tid++;
+            b->events.reserve(batch_size);
+            s.buffers.push_back(b);
+            return b;
+        }();
+        return *buf;
+    }
+
+    static void escape(std::string& out, const char* text)
+    {
+        for (auto const* p = text; *p != 0; p++) {
+            auto c = static_cast<unsigned char>(*p);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c < 0x20) {
+                char hex[8];
+                std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+                out += hex;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+
+    static void write(State& s, std::vector<Event> const& events)
+    {
+        using us = std::chrono::duration<double, std::micro>;
+        std::string json;
+        for (auto const& e : events) {
+            if (e.start < s.epoch) { continue; } // From an earlier trace
+            json += s.first ? "\n" : ",\n";
+            s.first = false;
+            json += R"({"name":")";
+            escape(json, e.name);
+            json += R"(","cat":")";
+            escape(json, e.cat);
+            char times[96];
+            std::snprintf(times, sizeof(times),
+                          R"(","ph":"X","ts":%.3f,"dur":%.3f,"pid":1,"tid":%u)",
+                          us(e.start - s.epoch).count(),
+                          us(e.end - e.start).count(), e.tid);
+            json += times;
+            if (!e.detail.empty()) {
+                json += R"(,"args":{"detail":")";
+                escape(json, e.detail.c_str());
+                json += "\"}";
+            }
+            json += '}';
+        }
+        std::fwrite(json.data(), 1, json.size(), s.out);
+    }
+
+    static void run_writer()
+    {
+        auto& s = state();
+        std::unique_lock<std::mutex> guard(s.lock);
+        while (true) {
+            s.wake.wait(guard, [&] { return s.done || !s.queue.empty(); });
+            while (!s.queue.empty()) {
+                auto events = std::move(s.queue.front());
+                s.queue.pop_front();
+                guard.unlock();
+                write(s, events);
+                guard.lock();
+            }
+            if (s.done) { return; }
+        }
+    }
+
+public:
+    [[nodiscard]] static bool enabled()
+    {
+        return state().enabled.load(std::memory_order_relaxed);
+    }
+
+    //! Start writing a trace to `path`. Returns false if it could not be
+    //! opened, or a trace is already running.
+    static bool start(std::string const& path)
+    {
+        auto& s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        if (s.out != nullptr) { return false; }
+        s.out = std::fopen(path.c_str(), "wb");
+        if (s.out == nullptr) { return false; }
+        std::fputs(R"({"displayTimeUnit":"ns","traceEvents":[)", s.out);
+        s.first = true;
+        s.done = false;
+        s.queue.clear();
+        s.epoch = Clock::now();
+        s.writer = std::thread(&Tracer::run_writer);
+        s.enabled = true;
+        return true;
+    }
+
+    //! Stop tracing, write out all buffered events and close the file
+    static void stop()
+    {
+        auto& s = state();
+        if (!s.enabled.exchange(false)) { return; }
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            for (auto const& b : s.buffers) {
+                std::lock_guard<std::mutex> bguard(b->lock);
+                if (!b->events.empty()) {
+                    s.queue.push_back(std::move(b->events));
+                    b->events.clear();
+                }
+            }
+            s.done = true;
+        }
+        s.wake.notify_one();
+        s.writer.join();
+        std::lock_guard<std::mutex> guard(s.lock);
+        std::fputs("\n]}\n", s.out);
+        std::fclose(s.out);
+        s.out = nullptr;
+    }
+
+    //! A copy of `name` that lives as long as the process, for event names
+    //! that are not string literals
+    static const char* intern(std::string const& name)
+    {
+        auto& s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        return s.names.insert(name).first->c_str();
+    }
+
+    static void add(const char* name, const char* cat, Clock::time_point start,
+                    Clock::time_point end, std::string detail = {})
+    {
+        auto& b = buffer();
+        std::unique_lock<std::mutex> guard(b.lock);
+        b.events.push_back({name, cat, start, end, b.tid, std::move(detail)});
+        if (b.events.size() >= batch_size) {
+            auto events = std::move(b.events);
+            b.events.clear();
+            b.events.reserve(batch_size);
+            guard.unlock();
+            auto& s = state();
+            {
+                std::lock_guard<std::mutex> sguard(s.lock);
+                if (s.out == nullptr) { return; }
+                s.queue.push_back(std::move(events));
+            }
+            s.wake.notify_one();
+        }
+    }
+};
+
+#ifdef MRB_TRACE
+
+//! Records a complete event from its construction to its destruction, if
+//! a trace is running
+class TraceSpan
+{
+    const char* name;
+    const char* cat;
+    bool active = Tracer::enabled();
+    Tracer::Clock::time_point start{};
+    std::string detail;
+
+public:
+    TraceSpan(const char* _name, const char* _cat,
+              const char* _detail = nullptr)
+        : name(_name), cat(_cat)
+    {
+        if (active) {
+            detail = _detail == nullptr ? "" : _detail;
+            start = Tracer::Clock::now();
+        }
+    }
+    TraceSpan(TraceSpan const&) = delete;
+    TraceSpan& operator=(TraceSpan const&) = delete;
+
+    ~TraceSpan()
+    {
+        if (active) {
+            Tracer::add(name, cat, start, Tracer::Clock::now(),
+                        std::move(detail));
+        }
+    }
+};
+
+#else
+
+class TraceSpan
+{
+public:
+    TraceSpan(const char* /*name*/, const char* /*cat*/,
+              const char* /*detail*/ = nullptr)
+    {}
+};
+
+#endif
+
+} // namespace mrb
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Upper limit on the number of native types registered with make_class()
+#ifndef MRB_MAX_CLASSES
+#define MRB_MAX_CLASSES 1024
+#endif
+
+namespace mrb {
+
+//! How a ruby object holds on to its native object
+enum class Holder : uint8_t
+{
+    Owned,    //!< A raw pointer, deleted when the ruby object is collected
+    Borrowed, //!< A raw pointer that ruby never frees
+    Shared    //!< A std::shared_ptr, released when the ruby object is collected
+};
+
+struct TypeInfo;
+
+// The data type of ruby objects for a registered native type. There is one
+// per type and Holder, and they all live in one array so objects of
+// registered types can be recognized from their data type pointer alone.
+struct DataType
+{
+    mrb_data_type type; // Must be first; this is the part ruby sees
+    TypeInfo const* info;
+    Holder holder;
+};
+
+// Process wide information about a registered native type. Each type gets
+// an integer tag, and the set of tags of the type and all its declared base
+// classes, so checking if an object can be used as a given type is a single
+// bit test.
+struct TypeInfo
+{
+    struct Base
+    {
+        TypeInfo const* info;
+        void* (*upcast)(void*);
+    };
+
+    uint32_t tag{};
+    std::bitset<MRB_MAX_CLASSES> ancestors;
+    std::vector<Base> bases;
+    //! Bytes used by a native object, as reported by heap_census()
+    size_t (*native_size)(void const*) = nullptr;
+
+    // Convert a pointer to this type to a pointer to the ancestor with tag
+    // `target`
+    void* upcast(void* ptr, uint32_t target) const
+    {
+        if (target == tag) {
+            return ptr;
+        }
+        for (auto const& base : bases) {
+            if (base.info->ancestors.test(target)) {
+                return base.info->upcast(base.upcast(ptr), target);
+            }
+        }
+        return nullptr;
+    }
+};
+
+namespace detail {
+
+inline std::array<std::array<DataType, 3>, MRB_MAX_CLASSES> data_types{};
+
+inline std::mutex& type_mutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+inline void free_shared(mrb_state*, void* data)
+{
+    delete static_cast<std::shared_ptr<void>*>(data);
+}
+
+inline void init_type_info(TypeInfo& info, void (*dfree)(mrb_state*, void*))
+{
+    static std::atomic<uint32_t> next_tag{0};
+    info.tag = next_tag++;
+    if (info.tag >= MRB_MAX_CLASSES) {
+        throw mrb_exception("Too many classes, increase MRB_MAX_CLASSES");
+    }
+    info.ancestors.set(info.tag);
+    auto& types = data_types[info.tag];
+    types[0] = {{"", dfree}, &info, Holder::Owned};
+    types[1] = {{"", nullptr}, &info, Holder::Borrowed};
+    types[2] = {{"", &free_shared}, &info, Holder::Shared};
+}
+
+} // namespace detail
+
+template <typename T>
+void free_owned(mrb_state*, void* data)
+{
+    delete static_cast<T*>(data);
+}
+
+template <typename T>
+TypeInfo& type_info()
+{
+    static TypeInfo info;
+    static bool const init = [] {
+        detail::init_type_info(info, &free_owned<T>);
+        info.native_size = [](void const*) { return sizeof(T); };
+        return true;
+    }();
+    (void)init;
+    return info;
+}
+
+template <typename T>
+mrb_data_type const* data_type(Holder holder = Holder::Owned)
+{
+    return &detail::data_types[type_info<T>().tag][static_cast<int>(holder)]
+                .type;
+}
+
+//! Get the DataType for `type`, or nullptr if it is not the data type of a
+//! registered native type
+inline DataType const* data_type_of(mrb_data_type const* type)
+{
+    auto addr = reinterpret_cast<uintptr_t>(type);
+    auto begin = reinterpret_cast<uintptr_t>(detail::data_types.data());
+    if (addr < begin || addr >= begin + sizeof(detail::data_types)) {
+        return nullptr;
+    }
+    return reinterpret_cast<DataType const*>(type); // NOLINT
+}
+
+//! Get the DataType of `obj`, or nullptr if it is not an object of a
+//! registered native type
+inline DataType const* data_type_of(mrb_value obj)
+{
+    if (mrb_immediate_p(obj) || mrb_type(obj) != MRB_TT_DATA) {
+        return nullptr;
+    }
+    return data_type_of(DATA_TYPE(obj));
+}
+
+//! Declare BASE as a base class of T, so objects of T can be passed where a
+//! BASE is expected. BASE should be registered before T.
+template <typename T, typename BASE>
+void add_base()
+{
+    static_assert(std::is_base_of_v<BASE, T>);
+    auto& info = type_info<T>();
+    auto const& base = type_info<BASE>();
+    std::lock_guard const lock(detail::type_mutex());
+    if (info.ancestors.test(base.tag)) {
+        return;
+    }
+    info.bases.push_back({&base, [](void* p) -> void* {
+                              return static_cast<BASE*>(static_cast<T*>(p));
+                          }});
+    info.ancestors |= base.ancestors;
+}
+
+// Per state data for a class registered with make_class()
+struct ClassData
+{
+   RClass* rclass;
+};
+
+template <typename CLASS>
+struct Lookup
+{
+    static inline std::unordered_map<mrb_state*, ClassData> rclasses;
+};
+
+// Associate the native type T with `rclass`. Objects created by ruby, or
+// passed to ruby as raw pointers, are deleted when garbage collected.
+template <typename T>
+void register_class(mrb_state* mrb, RClass* rclass, const char* name)
+{
+    auto& types = detail::data_types[type_info<T>().tag];
+    if (*types[0].type.struct_name == 0) {
+        for (auto& dt : types) {
+            dt.type.struct_name = name;
+        }
+    }
+    Lookup<T>::rclasses[mrb] = {rclass};
+    MRB_SET_INSTANCE_TT(rclass, MRB_TT_DATA);
+}
+
+// Get the native pointer of an object of a registered type, before any
+// conversion to a base class
+inline void* holder_ptr(DataType const* dt, void* data)
+{
+    if (dt->holder == Holder::Shared) {
+        return static_cast<std::shared_ptr<void>*>(data)->get();
+    }
+    return data;
+}
+
+//! Get the native object from a ruby object, without checking that it is a
+//! T. `obj` must be an object of T or of a type derived from it. Returns
+//! nullptr for objects that are not of a registered native type, like data
+//! objects made by mruby or other libraries.
+template <typename T>
+T* native_ptr(mrb_value obj)
+{
+    auto const* dt = data_type_of(obj);
+    if (dt == nullptr || DATA_PTR(obj) == nullptr) {
+        return nullptr;
+    }
+    auto const& target = type_info<T>();
+    void* ptr = holder_ptr(dt, DATA_PTR(obj));
+    if (dt->info != &target) {
+        ptr = dt->info->upcast(ptr, target.tag);
+    }
+    return static_cast<T*>(ptr);
+}
+
+} // namespace mrb
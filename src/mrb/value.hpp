@@ -1,36 +1,37 @@
 #pragma once
 #include "base.hpp"
+#include "result.hpp"
+#include "trace.hpp"
+
+#include <array>
 
 namespace mrb {
 
 
+//! Call `handler` with the given arguments, returning its result or the
+//! exception it raised. The result is protected by the GC arena only.
 template <typename... T>
-bool call_proc(mrb_state* ruby, mrb_value handler, T... arg)
+Result<mrb_value> try_call_proc(mrb_state* ruby, mrb_value handler, T... arg)
 {
-    if (mrb_nil_p(handler)) { return false; }
-
-    mrb_funcall(
-        ruby, handler, "call", sizeof...(arg), mrb::to_value(arg, ruby)...);
+    TraceSpan span("call_proc", "script");
+    std::array<mrb_value, sizeof...(arg)> argv{mrb::to_value(arg, ruby)...};
+    auto res = mrb_funcall_argv(ruby, handler, sym<names::call>(ruby),
+                                static_cast<mrb_int>(argv.size()), argv.data());
     if (ruby->exc != nullptr) {
-        auto bt = mrb_funcall(ruby, mrb_obj_value(ruby->exc), "backtrace", 0);
-
-        std::vector<std::string> backtrace;
-        for(int i=0; i< ARY_LEN(mrb_ary_ptr(bt)); i++) {
-            auto v = mrb_ary_entry(bt, i);
-            auto s = mrb_funcall(ruby, v, "to_s", 0);
-            std::string line(RSTRING_PTR(s), RSTRING_LEN(s));
-            backtrace.emplace_back(line);
-        }
-
-        auto obj = mrb_funcall(ruby, mrb_obj_value(ruby->exc), "inspect", 0);
-        std::string err(RSTRING_PTR(obj), RSTRING_LEN(obj));
+        return Error::take(ruby);
+    }
+    return res;
+}
 
-        ruby->exc = nullptr;
-        throw mrb_exception(err);
+//! Call `handler` unless it is nil, throwing mrb_exception if it raised
+template <typename... T>
+bool call_proc(mrb_state* ruby, mrb_value handler, T... arg)
+{
+    if (mrb_nil_p(handler)) { return false; }
 
-        //ErrorState::stack.push_back({ErrorType::Exception, backtrace, err});
-        //fmt::print("Error: {}\n", err);
-        return true;
+    auto res = try_call_proc(ruby, handler, arg...);
+    if (!res) {
+        throw mrb_exception(res.error().message());
     }
     return true;
 }
@@ -75,6 +76,13 @@ struct Value
         call_proc(mrb, val, args...);
     }
 
+    //! Call the value without throwing
+    template <typename... ARGS>
+    Result<mrb_value> try_call(ARGS... args)
+    {
+        return try_call_proc(mrb, val, args...);
+    }
+
     Value() = default;
 
     void set_from_val(mrb_state* _mrb, mrb_value v)
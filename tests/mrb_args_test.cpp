@@ -1,5 +1,10 @@
 // #include <fmt/core.h>
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
 
 #include <doctest/doctest.h>
 
@@ -27,6 +32,26 @@ TEST_CASE("get_args")
     RUBY_CHECK("test(false, 'hello', 3.14) == 'false/hello/3.140000'");
 }
 
+TEST_CASE("wide integer arguments")
+{
+    mrb::mruby ruby;
+    ruby.add_kernel_function("twice64", [](int64_t x) { return x * 2; });
+    ruby.add_kernel_function("next32", [](uint32_t x) { return x + 1; });
+    ruby.exec(R"(
+raise 'int64' unless twice64(1 << 20) == 1 << 21
+raise 'int64 big' unless twice64(2 ** 40) == 2 ** 41
+raise 'uint32' unless next32(3_000_000_000) == 3_000_000_001
+)");
+}
+
+TEST_CASE("wide integer results")
+{
+    auto* ruby = mrb_open();
+    mrb::add_kernel_function(ruby, "huge", [] { return UINT64_MAX; });
+    RUBY_CHECK("begin ; huge ; false ; rescue RangeError ; true ; end");
+    mrb_close(ruby);
+}
+
 struct Person
 {
     std::string name;
@@ -65,6 +90,399 @@ TEST_CASE("class")
     mrb_load_string(ruby, "GC.start");
     CHECK(Person::counter == 0);
 
+    // Data objects not made by this library have no native object
+    static mrb_data_type const foreign{"Foreign", nullptr};
+    static int payload = 0;
+    auto obj = mrb_obj_value(
+        mrb_data_object_alloc(ruby, ruby->object_class, &payload, &foreign));
+    CHECK(mrb::native_ptr<Person>(obj) == nullptr);
+
+    mrb_close(ruby);
+}
+
+TEST_CASE("return objects")
+{
+    auto* ruby = mrb_open();
+    static Person owner;
+    owner.age = 40;
+    auto count = Person::counter;
+
+    mrb::make_class<Person>(ruby, "Person");
+    mrb::add_method<Person>(ruby, "age",
+                            [](Person const* person) { return person->age; });
+    mrb::add_class_method<Person>(ruby, "create", [](int age) {
+        auto p = std::make_unique<Person>();
+        p->age = age;
+        return p;
+    });
+    mrb::add_class_method<Person>(ruby, "copy", [](int age) {
+        Person p;
+        p.age = age;
+        return p;
+    });
+    mrb::add_class_method<Person>(ruby, "owner",
+                                  []() { return mrb::borrow(&owner); });
+    mrb::add_method<Person>(ruby, "twin",
+                            [](Person const* p) { return *p; });
+
+    RUBY_CHECK("Person.create(3).age == 3");
+    RUBY_CHECK("Person.copy(4).age == 4");
+    RUBY_CHECK("Person.copy(6).twin.age == 6");
+    RUBY_CHECK("Person.owner.age == 40");
+    mrb_load_string(ruby, "GC.start");
+    CHECK(Person::counter == count);
+    CHECK(owner.age == 40);
+
+    // Borrowed objects can be passed back to native functions
+    mrb::add_method<Person>(ruby, "older_than",
+                            [](Person const* self, Person const* other) {
+                                return self->age > other->age;
+                            });
+    RUBY_CHECK("!Person.create(3).older_than(Person.owner)");
+    RUBY_CHECK("begin ; Person.create(1).older_than(5) ; false ; rescue TypeError ; true ; end");
+
+    mrb_close(ruby);
+}
+
+struct Engine
+{
+    int frames = 0;
+};
+
+TEST_CASE("shared objects")
+{
+    auto* ruby = mrb_open();
+    mrb::make_shared_ptr_class<Engine>(ruby, "Engine");
+    mrb::add_method<Engine>(ruby, "frames",
+                            [](Engine const* e) { return e->frames; });
+
+    static std::shared_ptr<Engine> kept;
+    mrb::add_kernel_function(ruby, "keep",
+                             [](std::shared_ptr<Engine> e) { kept = e; });
+
+    auto engine = std::make_shared<Engine>();
+    engine->frames = 10;
+    mrb_define_global_const(ruby, "ENGINE", mrb::to_value(engine, ruby));
+    CHECK(engine.use_count() == 2);
+    RUBY_CHECK("ENGINE.frames == 10");
+    engine->frames = 11;
+    RUBY_CHECK("ENGINE.frames == 11");
+
+    // Objects created from ruby can be shared with native code
+    mrb_load_string(ruby, "keep(Engine.new)");
+    mrb_load_string(ruby, "GC.start");
+    REQUIRE(kept != nullptr);
+    CHECK(kept.use_count() == 1);
+    kept = nullptr;
+
+    mrb_define_global_const(ruby, "NO_ENGINE",
+                            mrb::to_value(std::shared_ptr<Engine>{}, ruby));
+    RUBY_CHECK("NO_ENGINE.nil?");
+
+    mrb_close(ruby);
+    CHECK(engine.use_count() == 1);
+}
+
+struct Named
+{
+    std::string name = "named";
+};
+
+struct Shape
+{
+    virtual ~Shape() = default;
+    int id = 7;
+};
+
+struct Circle : Named, Shape
+{
+    float radius = 2.0F;
+};
+
+TEST_CASE("base classes")
+{
+    auto* ruby = mrb_open();
+    mrb::make_class<Named>(ruby, "Named");
+    mrb::make_class<Shape>(ruby, "Shape");
+    mrb::make_class<Circle, Shape, Named>(ruby, "Circle");
+
+    mrb::add_method<Shape>(ruby, "id", [](Shape const* s) { return s->id; });
+    mrb::add_kernel_function(ruby, "shape_id",
+                             [](Shape const* s) { return s->id; });
+    mrb::add_kernel_function(ruby, "name_of",
+                             [](Named const* n) { return n->name; });
+
+    RUBY_CHECK("Circle.new.is_a?(Shape)");
+    RUBY_CHECK("Circle.new.id == 7");
+    RUBY_CHECK("shape_id(Circle.new) == 7");
+    RUBY_CHECK("name_of(Circle.new) == 'named'");
+    RUBY_CHECK("begin ; shape_id(Named.new) ; false ; rescue TypeError ; true ; end");
+    RUBY_CHECK("begin ; shape_id('circle') ; false ; rescue TypeError ; true ; end");
+
+    mrb_close(ruby);
+}
+
+enum class Direction
+{
+    Up,
+    Down
+};
+
+template <>
+struct mrb::Enums<Direction>
+{
+    static constexpr std::array value{mrb::enumerator("up", Direction::Up),
+                                      mrb::enumerator("down", Direction::Down)};
+};
+
+struct Elevator
+{
+    Direction direction = Direction::Up;
+};
+
+TEST_CASE("enums")
+{
+    auto* ruby = mrb_open();
+    mrb::make_class<Elevator>(ruby, "Elevator");
+    mrb::define_enum<Elevator, Direction>(ruby);
+    mrb::attr_accessor<&Elevator::direction>(ruby, "direction");
+    mrb::add_method<Elevator>(
+        ruby, "go", [](Elevator* e, Direction d) { e->direction = d; });
+
+    RUBY_CHECK("Elevator::DOWN == :down");
+    RUBY_CHECK("e = Elevator.new ; e.go(:down) ; e.direction == :down");
+    RUBY_CHECK("e = Elevator.new ; e.direction = Elevator::DOWN ; e.direction == :down");
+    RUBY_CHECK("begin ; Elevator.new.go(:sideways) ; false ; rescue ArgumentError ; true ; end");
+
+    mrb_close(ruby);
+}
+
+TEST_CASE("optional, variant and tuple")
+{
+    auto* ruby = mrb_open();
+
+    mrb::add_kernel_function(
+        ruby, "greet", [](std::string const& name, std::optional<int> times) {
+            std::string res;
+            for (int i = 0; i < times.value_or(1); i++) {
+                res += "hello " + name;
+            }
+            return res;
+        });
+    mrb::add_kernel_function(ruby, "kind",
+                             [](std::variant<int, float, std::string> v) {
+                                 return static_cast<int>(v.index());
+                             });
+    mrb::add_kernel_function(ruby, "divmod2", [](int a, int b) {
+        return std::pair{a / b, a % b};
+    });
+    mrb::add_kernel_function(
+        ruby, "find_name", [](int id) -> std::optional<std::string> {
+            if (id == 1) { return "one"; }
+            return std::nullopt;
+        });
+
+    RUBY_CHECK("greet('you') == 'hello you'");
+    RUBY_CHECK("greet('you', 2) == 'hello youhello you'");
+    RUBY_CHECK("kind(3) == 0 && kind(3.0) == 1 && kind('3') == 2");
+    RUBY_CHECK("begin ; kind([]) ; false ; rescue TypeError ; true ; end");
+    RUBY_CHECK("divmod2(7, 2) == [3, 1]");
+    RUBY_CHECK("find_name(1) == 'one' && find_name(2).nil?");
+
+    auto t = mrb::value_to<std::tuple<int, std::string>>(
+        mrb_load_string(ruby, "[5, 'five']"), ruby);
+    CHECK(std::get<0>(t) == 5);
+    CHECK(std::get<1>(t) == "five");
+
+    mrb_close(ruby);
+}
+
+struct WindowOptions
+{
+    int width = 0;
+    int height = 480;
+    std::string title = "untitled";
+
+    static constexpr auto fields()
+    {
+        return std::tuple{mrb::field("title", &WindowOptions::title),
+                          mrb::required_field("width", &WindowOptions::width),
+                          mrb::field("height", &WindowOptions::height)};
+    }
+};
+
+TEST_CASE("keyword arguments")
+{
+    auto* ruby = mrb_open();
+
+    mrb::add_kernel_function(
+        ruby, "open_window", [](int id, mrb::Kwargs<WindowOptions> opts) {
+            return std::to_string(id) + ":" + opts->title + ":" +
+                   std::to_string(opts->width) + "x" +
+                   std::to_string(opts->height);
+        });
+
+    RUBY_CHECK("open_window(1, width: 640) == '1:untitled:640x480'");
+    RUBY_CHECK("open_window(2, title: 'game', width: 800, height: 600) == "
+               "'2:game:800x600'");
+    RUBY_CHECK("begin ; open_window(3) ; false ; rescue ArgumentError ; true ; end");
+    RUBY_CHECK("begin ; open_window(3, width: 1, depth: 2) ; false ; rescue "
+               "ArgumentError ; true ; end");
+
+    mrb_close(ruby);
+}
+
+struct Canvas
+{
+    std::string last;
+};
+
+TEST_CASE("overloads")
+{
+    auto* ruby = mrb_open();
+    mrb::make_class<Canvas>(ruby, "Canvas");
+    mrb::add_overloads<Canvas>(
+        ruby, "draw",
+        [](Canvas* c, int x, int y) {
+            c->last = "point " + std::to_string(x) + "," + std::to_string(y);
+        },
+        [](Canvas* c, float x) { c->last = "float"; },
+        [](Canvas* c, std::string const& text) { c->last = "text " + text; },
+        [](Canvas* c, Canvas const* other) { c->last = "canvas"; });
+    mrb::attr_reader<&Canvas::last>(ruby, "last");
+
+    RUBY_CHECK("c = Canvas.new ; c.draw(1, 2) ; c.last == 'point 1,2'");
+    RUBY_CHECK("c = Canvas.new ; c.draw('hi') ; c.last == 'text hi'");
+    RUBY_CHECK("c = Canvas.new ; c.draw(2.5) ; c.last == 'float'");
+    RUBY_CHECK("c = Canvas.new ; c.draw(3) ; c.last == 'float'");
+    RUBY_CHECK("c = Canvas.new ; c.draw(Canvas.new) ; c.last == 'canvas'");
+    RUBY_CHECK("begin ; Canvas.new.draw([]) ; false ; rescue ArgumentError ; true ; end");
+
+    mrb_close(ruby);
+}
+
+TEST_CASE("stateful callables")
+{
+    auto* ruby = mrb_open();
+
+    // One lambda type, bound twice with different captures
+    for (std::string prefix : {"a", "b"}) {
+        auto fn = [prefix](std::string const& s) { return prefix + s; };
+        mrb::add_kernel_function(ruby, "prefix_" + prefix, fn);
+    }
+    RUBY_CHECK("prefix_a('x') == 'ax' && prefix_b('x') == 'bx'");
+
+    auto* other = mrb_open();
+    auto make = [](int n) { return [n]() { return n; }; };
+    mrb::add_kernel_function(ruby, "number", make(1));
+    mrb::add_kernel_function(other, "number", make(2));
+    RUBY_CHECK("number == 1");
+    CHECK(mrb::value_to<int>(mrb_load_string(other, "number")) == 2);
+    mrb_close(other);
+
+    mrb_close(ruby);
+}
+
+struct Player
+{
+    int score = 0;
+    int lives = 3;
+    std::string name = "player";
+    void add_score(int s) { score += s; }
+    [[nodiscard]] bool alive() const { return lives > 0; }
+
+    static constexpr auto bindings()
+    {
+        return std::tuple{
+            mrb::method<&Player::add_score>("add_score"),
+            mrb::method<&Player::alive>("alive?"),
+            mrb::method("reset", [](Player* p) { p->score = 0; }),
+            mrb::reader<&Player::score>("score"),
+            mrb::writer<&Player::lives>("lives"),
+            mrb::accessor<&Player::name>("name"),
+            mrb::constant("MAX_LIVES", 5)};
+    }
+};
+
+TEST_CASE("binding tables")
+{
+    auto* ruby = mrb_open();
+    mrb::make_class<Player>(ruby, "Player");
+
+    RUBY_CHECK("p = Player.new ; p.add_score(5) ; p.add_score(2) ; p.score == 7");
+    RUBY_CHECK("p = Player.new ; p.add_score(5) ; p.reset ; p.score == 0");
+    RUBY_CHECK("p = Player.new ; p.lives = 0 ; !p.alive?");
+    RUBY_CHECK("p = Player.new ; p.name = 'one' ; p.name == 'one'");
+    RUBY_CHECK("Player::MAX_LIVES == 5");
+    RUBY_CHECK("!Player.new.respond_to?(:lives)");
+
+    mrb_close(ruby);
+}
+
+struct Monster
+{
+    int hp = 10;
+    void hit(int damage) { hp -= damage; }
+
+    static constexpr auto registration = mrb::Registration::Lazy;
+    static constexpr auto bindings()
+    {
+        return std::tuple{mrb::method<&Monster::hit>("hit"),
+                          mrb::accessor<&Monster::hp>("hp"),
+                          mrb::method("to_s",
+                                      [](Monster const* m) {
+                                          return "hp " + std::to_string(m->hp);
+                                      }),
+                          mrb::constant("MAX_HP", 100)};
+    }
+};
+
+struct Boss : Monster
+{
+    int rage = 0;
+    void roar() { rage++; }
+
+    static constexpr auto registration = mrb::Registration::Lazy;
+    static constexpr auto bindings()
+    {
+        return std::tuple{mrb::method<&Boss::roar>("roar"),
+                          mrb::reader<&Boss::rage>("rage")};
+    }
+};
+
+TEST_CASE("lazy binding tables")
+{
+    auto* ruby = mrb_open();
+    mrb::make_class<Monster>(ruby, "Monster");
+
+    RUBY_CHECK("Monster::MAX_HP == 100");
+    RUBY_CHECK("!Monster.method_defined?(:hit)");
+    RUBY_CHECK("Monster.new.respond_to?(:hit) && Monster.new.respond_to?(:hp=)");
+    RUBY_CHECK("m = Monster.new ; m.hit(3) ; m.hp == 7");
+    RUBY_CHECK("Monster.method_defined?(:hit)");
+    RUBY_CHECK("m = Monster.new ; m.hp = 1 ; m.hp == 1");
+    RUBY_CHECK("begin ; Monster.new.fly ; false ; rescue NoMethodError ; true ; end");
+
+    // Names that Object already has are bound up front
+    RUBY_CHECK("Monster.new.to_s == 'hp 10'");
+
+    // Names missing from a lazy table go on to the lazy table of the base
+    mrb::make_class<Boss, Monster>(ruby, "Boss");
+    RUBY_CHECK("b = Boss.new ; b.roar ; b.hit(4) ; b.rage == 1 && b.hp == 6");
+    RUBY_CHECK("Boss.new.respond_to?(:hp=) && !Boss.new.respond_to?(:fly)");
+    RUBY_CHECK("begin ; Boss.new.fly ; false ; rescue NoMethodError ; true ; end");
+
+    // and then to any method_missing above that
+    mrb_load_string(ruby, R"(
+module Growl
+  def method_missing(name, *args)
+    name == :growl ? "grr #{args.size}" : super
+  end
+end
+class Monster ; include Growl ; end
+)");
+    RUBY_CHECK("Boss.new.growl(1, 2) == 'grr 2'");
+
     mrb_close(ruby);
 }
 
@@ -135,9 +553,257 @@ TEST_CASE("callback")
 
     callback();
     CHECK(counter == 1);
+    // The state is closed before the static goes away
+    callback.clear();
 
 }
 
+TEST_CASE("errors without exceptions")
+{
+    static mrb::Value handler;
+    mrb::mruby ruby;
+
+    ruby.add_kernel_function("on_event", [](mrb::Block v) { handler = v; });
+
+    auto res = ruby.try_exec("1 + 2");
+    REQUIRE(res);
+    CHECK(mrb::value_to<int>(res.value()) == 3);
+
+    res = ruby.try_exec("raise ArgumentError, 'bad'", "test.rb");
+    REQUIRE(!res);
+    CHECK(res.error().exception_class() ==
+          mrb_class_get(ruby.ptr(), "ArgumentError"));
+    CHECK(ruby.ptr()->exc == nullptr);
+    CHECK(res.error().message().find("bad") != std::string::npos);
+    CHECK(!res.error().backtrace().empty());
+    CHECK_THROWS_AS(res.value(), mrb::mrb_exception);
+
+    ruby.exec("on_event { |x| raise 'odd' if x.odd? ; x * 2 }");
+    auto r = handler.try_call(4);
+    REQUIRE(r);
+    CHECK(mrb::value_to<int>(r.value()) == 8);
+    CHECK(!handler.try_call(3));
+    CHECK_THROWS_AS(handler(3), mrb::mrb_exception);
+    handler.clear();
+
+    // Errors may outlive their state
+    std::optional<mrb::Error> late;
+    {
+        mrb::mruby other;
+        auto r2 = other.try_exec("raise 'late'");
+        REQUIRE(!r2);
+        late = r2.error();
+        CHECK(late->message().find("late") != std::string::npos);
+    }
+    CHECK(late->message().find("late") != std::string::npos);
+    CHECK(late->exception_class() == nullptr);
+    late.reset();
+}
+
+TEST_CASE("memory limits")
+{
+    auto alloc = std::make_shared<mrb::PoolAllocator>();
+    mrb::mruby ruby{alloc};
+    ruby.exec("a = [1, 2, 3].map { |x| x.to_s * 10 }");
+
+    auto stats = ruby.memory();
+    CHECK(stats.bytes > 0);
+    CHECK(stats.allocations > 0);
+    CHECK(stats.peak_bytes >= stats.bytes);
+    CHECK(stats.total_allocations >= stats.allocations);
+
+    alloc->set_limit(stats.bytes + 256 * 1024);
+    auto res = ruby.try_exec("s = 'x' * 4_000_000");
+    REQUIRE(!res);
+    CHECK(res.error().exception_class() ==
+          mrb_class_get(ruby.ptr(), "NoMemoryError"));
+    CHECK(ruby.memory().failed > 0);
+    CHECK(ruby.memory().bytes <= alloc->limit());
+
+    // The state is still usable
+    CHECK(ruby.try_exec("1 + 2"));
+    ruby.exec(R"(
+ok = begin
+  'y' * 4_000_000
+  false
+rescue NoMemoryError
+  true
+end
+raise 'not rescued' unless ok
+)");
+}
+
+TEST_CASE("gc control")
+{
+    using namespace std::chrono_literals;
+    mrb::mruby ruby;
+
+    ruby.gc_mode(mrb::GcMode::Generational);
+    CHECK(ruby.gc_mode() == mrb::GcMode::Generational);
+    ruby.gc_mode(mrb::GcMode::Incremental);
+    CHECK(ruby.gc_mode() == mrb::GcMode::Incremental);
+    ruby.gc_interval_ratio(150);
+    ruby.gc_step_ratio(50);
+    CHECK(ruby.ptr()->gc.interval_ratio == 150);
+
+    size_t seen = 0;
+    ruby.gc_on_pause([&](mrb::GcPause const&) { seen++; });
+
+    ruby.exec("100.times { |i| 'garbage' * i }");
+    auto pause = ruby.gc_full();
+    CHECK(pause.full);
+    CHECK(pause.freed > 0);
+
+    ruby.exec("100.times { |i| 'garbage' * i }");
+    pause = ruby.gc_step(10ms);
+    CHECK(!pause.full);
+
+    auto stats = ruby.gc_stats();
+    CHECK(stats.pauses == 2);
+    CHECK(seen == 2);
+    CHECK(stats.cycles >= 1);
+    CHECK(stats.longest >= stats.last.time);
+    CHECK(stats.total >= stats.longest);
+
+    // Nothing runs, or is recorded, while the collector is disabled
+    ruby.exec("GC.disable");
+    CHECK(!ruby.gc_full().completed);
+    CHECK(ruby.gc_stats().pauses == 2);
+    CHECK_THROWS_AS(ruby.gc_mode(mrb::GcMode::Generational),
+                    mrb::mrb_exception);
+    CHECK(ruby.ptr()->exc == nullptr);
+    ruby.exec("GC.enable");
+}
+
+TEST_CASE("binding stats")
+{
+    mrb::mruby ruby;
+    ruby.add_kernel_function("twice", [](int x) { return x * 2; });
+    mrb::define_binding_stats(ruby.ptr());
+    ruby.exec("2.times { twice(2) }; Kernel.twice(1)");
+
+    auto stats = ruby.binding_stats();
+#ifdef MRB_BINDING_STATS
+    // Kernel.twice and Kernel#twice are one binding
+    CHECK(std::count_if(stats.begin(), stats.end(), [](auto const& s) {
+              return s.name.find("twice") != std::string::npos;
+          }) == 1);
+    auto it = std::find_if(stats.begin(), stats.end(),
+                           [](auto const& s) { return s.name == "Kernel#twice"; });
+    REQUIRE(it != stats.end());
+    CHECK(it->calls == 3);
+    CHECK(std::accumulate(it->histogram.begin(), it->histogram.end(),
+                          uint64_t{0}) == 3);
+    ruby.exec(R"(
+found = binding_stats.find { |s| s[:name] == 'Kernel#twice' }
+raise 'no stats' unless found && found[:calls] == 3
+)");
+#else
+    CHECK(stats.empty());
+#endif
+}
+
+TEST_CASE("profiler")
+{
+    mrb::mruby ruby;
+#ifdef MRB_USE_DEBUG_HOOK
+    ruby.add_kernel_function("now_ms", [] {
+        return static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count() %
+            1000000);
+    });
+    ruby.start_profiler(std::chrono::microseconds(500));
+    ruby.exec(R"(
+def work(n)
+  x = 0
+  n.times { |i| x += i }
+  x
+end
+t = now_ms
+work(1000) while (now_ms - t).abs < 50
+)", "profile.rb");
+    auto stacks = ruby.stop_profiler();
+    CHECK(stacks.find(";work profile.rb:") != std::string::npos);
+#else
+    CHECK_THROWS_AS(ruby.start_profiler(), mrb::mrb_exception);
+#endif
+}
+
+TEST_CASE("trace events")
+{
+    mrb::mruby ruby;
+    ruby.add_kernel_function("twice", [](int x) { return x * 2; });
+
+    auto path = std::string("mrb_trace_test.json");
+    REQUIRE(mrb::Tracer::start(path));
+    CHECK(!mrb::Tracer::start(path));
+    ruby.exec("3.times { twice(2) }", "trace.rb");
+    ruby.gc_full();
+    mrb::Tracer::stop();
+
+    std::string json;
+    if (auto* f = std::fopen(path.c_str(), "rb")) {
+        std::array<char, 4096> buf{};
+        size_t n = 0;
+        while ((n = std::fread(buf.data(), 1, buf.size(), f)) > 0) {
+            json.append(buf.data(), n);
+        }
+        std::fclose(f);
+    }
+    std::remove(path.c_str());
+    CHECK(json.find("\"traceEvents\"") != std::string::npos);
+    CHECK(json.rfind("]}") != std::string::npos);
+#ifdef MRB_TRACE
+    CHECK(json.find(R"("name":"exec")") != std::string::npos);
+    CHECK(json.find(R"("detail":"trace.rb")") != std::string::npos);
+    CHECK(json.find(R"("name":"Kernel#twice")") != std::string::npos);
+    CHECK(json.find(R"("name":"gc_full")") != std::string::npos);
+#endif
+}
+
+struct Sprite
+{
+    std::vector<int> pixels = std::vector<int>(100);
+};
+
+TEST_CASE("heap census")
+{
+    mrb::mruby ruby;
+    mrb::make_class<Sprite>(ruby.ptr(), "Sprite");
+    mrb::set_native_size<Sprite>([](Sprite const* s) {
+        return sizeof(Sprite) + s->pixels.size() * sizeof(int);
+    });
+    ruby.exec("$keep = []");
+
+    auto before = ruby.heap_census();
+    CHECK(before.objects > 0);
+    CHECK(before.native.count("Sprite") == 0);
+
+    ruby.exec("10.times { $keep << Sprite.new } ; 5.times { Sprite.new }");
+    auto after = ruby.heap_census();
+    // Unreferenced objects are collected before the census, but one may
+    // still be held by a VM register
+    REQUIRE(after.native.count("Sprite") == 1);
+    auto sprites = after.native["Sprite"].objects;
+    CHECK(sprites >= 10);
+    CHECK(sprites <= 11);
+    CHECK(after.native["Sprite"].native_bytes ==
+          sprites * (sizeof(Sprite) + 100 * sizeof(int)));
+    CHECK(after.classes["Sprite"].objects == sprites);
+
+    auto diff = mrb::census_diff(before, after);
+    REQUIRE(!diff.native.empty());
+    CHECK(diff.native[0].name == "Sprite");
+    CHECK(diff.native[0].objects == static_cast<ptrdiff_t>(sprites));
+
+    ruby.exec("$keep.clear");
+    diff = mrb::census_diff(after, ruby.heap_census());
+    REQUIRE(!diff.native.empty());
+    CHECK(diff.native[0].objects <= -10);
+}
+
 TEST_CASE("retain")
 {
 
@@ -169,6 +835,58 @@ TEST_CASE("retain")
     CHECK(Person::counter == 0);
 }
 
+struct Game
+{
+    std::unordered_map<std::string, std::string> user{{"name", "sasq"}};
+    std::unordered_map<std::string, int> const limits{{"lives", 3}};
+    std::vector<int> scores{10, 20, 30};
+};
+
+TEST_CASE("proxy")
+{
+    auto* ruby = mrb_open();
+    mrb::make_class<Game>(ruby, "Game");
+    mrb::attr_proxy<&Game::user>(ruby, "user");
+    mrb::attr_proxy<&Game::limits>(ruby, "limits");
+    mrb::attr_proxy<&Game::scores>(ruby, "scores");
+
+    Game* game = new Game();
+    mrb_define_global_const(ruby, "GAME", mrb::to_value(game, ruby));
+
+    RUBY_CHECK("GAME.user['name'] == 'sasq'");
+    RUBY_CHECK("GAME.user['missing'] == nil");
+    mrb_load_string(ruby, "GAME.user['pass'] = 'secret'");
+    CHECK(game->user["pass"] == "secret");
+    RUBY_CHECK("GAME.user.size == 2 && GAME.user.keys.sort == ['name', 'pass']");
+
+    RUBY_CHECK("GAME.limits['lives'] == 3");
+    RUBY_CHECK("!GAME.limits.respond_to?(:[]=)");
+
+    mrb_load_string(ruby, "GAME.scores[-1] = 99");
+    CHECK(game->scores[2] == 99);
+    RUBY_CHECK("s = 0 ; GAME.scores.each { |v| s += v } ; s == 129");
+    RUBY_CHECK("GAME.scores.to_a == [10, 20, 99]");
+
+    // Writing to the container from the block does not break iteration
+    mrb_load_string(ruby, "u = GAME.user ; u.each { |k, v| u[k + '2'] = v }");
+    CHECK(game->user.size() == 4);
+    CHECK(game->user["name2"] == "sasq");
+
+    // The proxy keeps the game object alive
+    mrb_load_string(ruby, "$scores = Game.new.scores ; GC.start");
+    RUBY_CHECK("$scores.size == 3");
+
+#ifdef MRB_BINDING_STATS
+    // Proxy accessors are counted like other bindings
+    auto stats = mrb::binding_stats(ruby);
+    CHECK(std::any_of(stats.begin(), stats.end(), [](auto const& s) {
+        return s.name == "Game#scores" && s.calls > 0;
+    }));
+#endif
+
+    mrb_close(ruby);
+}
+
 #if 0
 
     auto p = mrb::new_obj<Person>(ruby);
@@ -1,8 +1,10 @@
 #include <doctest/doctest.h>
 
 #include <mrb/conv.hpp>
+#include <mrb/serialize.hpp>
 
 #include <any>
+#include <cstdint>
 
 using namespace std::string_literals;
 
@@ -36,6 +38,11 @@ TEST_CASE("value_to")
     CHECK(mrb::value_to<int>(v) == 3);
     CHECK(mrb::value_to<float>(v) == 3.0F);
     CHECK_THROWS(mrb::value_to<std::string>(v));
+    CHECK(!mrb::value_is<const char*>(v, false));
+
+    auto text = mrb_load_string(ruby, "'text'");
+    CHECK(mrb::value_is<const char*>(text, true));
+    CHECK(std::string(mrb::value_to<const char*>(text, ruby)) == "text");
 
     auto f = mrb_load_string(ruby, "1 == 2");
     auto t = mrb_load_string(ruby, "3 == 3");
@@ -95,3 +102,236 @@ TEST_CASE("to_value")
 
     mrb_close(ruby);
 }
+
+TEST_CASE("integer range")
+{
+    auto* ruby = mrb_open();
+    constexpr int64_t big = int64_t{1} << 40;
+    auto v = mrb::to_value(big, ruby);
+    mrb_define_global_const(ruby, "BIG", v);
+    RUBY_CHECK("BIG == 1099511627776");
+    CHECK(mrb::value_to<int64_t>(v) == big);
+    CHECK(mrb::value_to<double>(v) == 1099511627776.0);
+    CHECK(mrb::value_is<int64_t>(v, true));
+
+    // Unsigned values over 2^31 in a 32 bit mrb_int
+    auto u = mrb::to_value(uint32_t{3000000000}, ruby);
+    mrb_define_global_const(ruby, "U", u);
+    RUBY_CHECK("U == 3000000000");
+    CHECK(mrb::value_to<uint32_t>(u) == 3000000000U);
+
+    auto n = mrb::to_value(int64_t{-5}, ruby);
+    CHECK(mrb_integer_p(n));
+    CHECK(mrb::value_to<int64_t>(n) == -5);
+
+    // Too large to be exact as a float, in any build. Raises with a state,
+    // see "wide integer results".
+    CHECK_THROWS(mrb::to_value(UINT64_MAX, nullptr));
+    CHECK(!mrb::integer_fits(UINT64_MAX));
+
+    CHECK_THROWS(mrb::value_to<int32_t>(mrb_load_string(ruby, "1e20")));
+    CHECK(!mrb::value_is<int64_t>(mrb_load_string(ruby, "1e20"), true));
+    CHECK(!mrb::value_is<int64_t>(mrb_load_string(ruby, "2.5"), true));
+    mrb_close(ruby);
+}
+
+TEST_CASE("nested containers")
+{
+    auto* ruby = mrb_open();
+
+    std::map<std::string, std::vector<std::string>> groups;
+    groups["vowels"] = {"a", "e", "i"};
+    groups["empty"] = {};
+    mrb_define_global_const(ruby, "GROUPS", mrb::to_value(groups, ruby));
+    RUBY_CHECK("GROUPS['vowels'] == ['a', 'e', 'i'] && GROUPS['empty'] == []");
+
+    // Only the resulting array should be left in the arena
+    std::vector<std::string> big(10000);
+    for (int i = 0; i < static_cast<int>(big.size()); i++) {
+        big[i] = std::to_string(i);
+    }
+    auto arena = mrb_gc_arena_save(ruby);
+    auto v = mrb::to_value(big, ruby);
+    CHECK(mrb_gc_arena_save(ruby) == arena + 1);
+    CHECK(mrb::value_to<std::vector<std::string>>(v, ruby) == big);
+
+    std::vector<bool> flags{true, false, true};
+    mrb_define_global_const(ruby, "FLAGS", mrb::to_value(flags, ruby));
+    RUBY_CHECK("FLAGS == [true, false, true]");
+
+    mrb_close(ruby);
+}
+
+struct Config
+{
+    int width = 640;
+    float scale = 1.0F;
+    std::string title;
+    std::vector<int> sizes;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{mrb::field("width", &Config::width),
+                          mrb::field("scale", &Config::scale),
+                          mrb::field("title", &Config::title),
+                          mrb::field("sizes", &Config::sizes)};
+    }
+};
+
+struct Point
+{
+    int x;
+    int y;
+};
+
+template <>
+struct mrb::Fields<Point>
+{
+    static constexpr auto value =
+        std::tuple{mrb::field("x", &Point::x), mrb::field("y", &Point::y)};
+    static constexpr auto layout = mrb::Layout::Struct;
+};
+
+TEST_CASE("fields")
+{
+    auto* ruby = mrb_open();
+
+    Config config{800, 2.0F, "game", {1, 2}};
+    mrb_define_global_const(ruby, "CONFIG", mrb::to_value(config, ruby));
+    RUBY_CHECK("CONFIG == {width: 800, scale: 2.0, title: 'game', sizes: [1, 2]}");
+
+    auto c = mrb::value_to<Config>(
+        mrb_load_string(ruby, "{title: 'other', width: 320}"), ruby);
+    CHECK(c.width == 320);
+    CHECK(c.title == "other");
+    CHECK(c.scale == 1.0F);
+
+    mrb_define_global_const(ruby, "POINT", mrb::to_value(Point{3, 4}, ruby));
+    RUBY_CHECK("POINT.x == 3 && POINT.y == 4 && POINT.is_a?(Struct)");
+    auto p = mrb::value_to<Point>(mrb_load_string(ruby, "POINT"), ruby);
+    CHECK(p.x == 3);
+    CHECK(p.y == 4);
+    p = mrb::value_to<Point>(mrb_load_string(ruby, "{x: 7, y: 8}"), ruby);
+    CHECK(p.y == 8);
+
+    mrb_close(ruby);
+}
+
+enum class Color
+{
+    Red,
+    Green,
+    Blue = 4
+};
+
+template <>
+struct mrb::Enums<Color>
+{
+    static constexpr std::array value{mrb::enumerator("red", Color::Red),
+                                      mrb::enumerator("green", Color::Green),
+                                      mrb::enumerator("blue", Color::Blue)};
+};
+
+TEST_CASE("enums")
+{
+    auto* ruby = mrb_open();
+
+    mrb_define_global_const(ruby, "BLUE", mrb::to_value(Color::Blue, ruby));
+    RUBY_CHECK("BLUE == :blue");
+    CHECK(mrb::value_to<Color>(mrb_load_string(ruby, ":green"), ruby) ==
+          Color::Green);
+    CHECK(mrb::value_to<Color>(mrb_load_string(ruby, "4"), ruby) ==
+          Color::Blue);
+
+    std::vector<Color> colors{Color::Red, Color::Blue};
+    mrb_define_global_const(ruby, "COLORS", mrb::to_value(colors, ruby));
+    RUBY_CHECK("COLORS == [:red, :blue]");
+
+    mrb_close(ruby);
+}
+
+static constexpr char hello[] = "hello";
+
+TEST_CASE("symbol cache")
+{
+    auto* ruby = mrb_open();
+    auto* other = mrb_open();
+
+    CHECK(mrb::sym<hello>(ruby) == mrb_intern_cstr(ruby, "hello"));
+    CHECK(mrb::sym<hello>(other) == mrb_intern_cstr(other, "hello"));
+    CHECK(mrb::sym<hello>(ruby) == mrb_intern_cstr(ruby, "hello"));
+    CHECK(mrb::sym<mrb::names::inspect>(ruby) ==
+          mrb_intern_cstr(ruby, "inspect"));
+
+    mrb_close(other);
+    mrb_close(ruby);
+}
+
+TEST_CASE("serialize")
+{
+    auto* ruby = mrb_open();
+
+    std::string buf;
+    mrb::encode(ruby, mrb_load_string(ruby, "[1, 'a', nil, true, -100]"),
+                mrb::Format::MessagePack, buf);
+    CHECK(buf == "\x95\x01\xa1" "a\xc0\xc3\xd0\x9c"s);
+
+    auto v = mrb_load_string(
+        ruby, "{name: \"x\\n\", 'list' => [1, 2.5, false], 3 => {}}");
+    buf.clear();
+    mrb::encode(ruby, v, mrb::Format::Json, buf);
+    CHECK(buf == R"({"name":"x\n","list":[1,2.5,false],"3":{}})");
+
+    mrb_define_global_const(
+        ruby, "JSON_BACK", mrb::decode(ruby, mrb::Format::Json, buf));
+    RUBY_CHECK("JSON_BACK == {'name' => \"x\\n\", 'list' => [1, 2.5, false], "
+               "'3' => {}}");
+
+    buf.clear();
+    mrb::encode(ruby, v, mrb::Format::MessagePack, buf);
+    mrb_define_global_const(
+        ruby, "PACK_BACK", mrb::decode(ruby, mrb::Format::MessagePack, buf));
+    RUBY_CHECK("PACK_BACK == {'name' => \"x\\n\", 'list' => [1, 2.5, false], "
+               "3 => {}}");
+
+    // Objects without an encoding go through the hook
+    auto obj = mrb_load_string(ruby, "[Object.new]");
+    buf.clear();
+    CHECK_THROWS(mrb::encode(ruby, obj, mrb::Format::Json, buf));
+    buf.clear();
+    mrb::encode(ruby, obj, mrb::Format::Json, buf,
+                [](mrb::Encoder& enc, mrb_value) {
+                    enc.begin_map(1);
+                    enc.string("object");
+                    enc.boolean(true);
+                    return true;
+                });
+    CHECK(buf == R"([{"object":true}])");
+
+    CHECK_THROWS(mrb::decode(ruby, mrb::Format::Json, "[1,"));
+    CHECK_THROWS(mrb::decode(ruby, mrb::Format::Json, "{} x"));
+    CHECK_THROWS(mrb::decode(ruby, mrb::Format::MessagePack, "\x92\x01"));
+    CHECK(mrb::value_to<std::string>(mrb::decode(
+              ruby, mrb::Format::Json, R"("é😀")")) ==
+          "\xc3\xa9\xf0\x9f\x98\x80");
+    CHECK(mrb::value_to<std::string>(mrb::decode(
+              ruby, mrb::Format::Json, R"("\ud83d\ude00")")) ==
+          "\xf0\x9f\x98\x80");
+    for (auto const* bad : {R"("\ud83d")", R"("\ude00")", R"("\ud83dx")",
+                            R"("\ud83d\u0041")"}) {
+        CHECK_THROWS(mrb::decode(ruby, mrb::Format::Json, bad));
+    }
+
+    for (auto const* bad : {"+1", ".5", "1.", "01", "-", "1e", "1e+", "-.5",
+                            "1e400"}) {
+        CHECK_THROWS(mrb::decode(ruby, mrb::Format::Json, bad));
+    }
+    CHECK(mrb::value_to<double>(
+              mrb::decode(ruby, mrb::Format::Json, "-0.5e-1")) == -0.05);
+    CHECK(mrb::value_to<int>(mrb::decode(ruby, mrb::Format::Json, "-0")) == 0);
+    buf.clear();
+    mrb::encode(ruby, mrb_float_value(ruby, 0.1), mrb::Format::Json, buf);
+    CHECK(buf == "0.1");
+
+    mrb_close(ruby);
+}